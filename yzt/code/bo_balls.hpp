@@ -0,0 +1,85 @@
+#pragma once
+
+#include "bo_common.hpp"
+#include "bo_math.hpp"
+#include <vector>
+
+// The balls, as structure-of-arrays, so that a tick walks plain float
+// arrays however many balls there are. Balls are kept in the order they
+// were put into play; that order is what makes the update deterministic
+// (earlier balls get to a brick first), so removal keeps it too.
+//
+// Each ball also remembers for how long, from now, it can't possibly hit
+// anything; until then a tick only has to move it along. Bricks going away
+// can only make that longer, so it stays a safe bound; moving or adding a
+// ball (or adding a brick) has to drop it.
+
+struct BallStore {
+    int count;
+    std::vector<float> x, y;            // center
+    std::vector<float> dir_x, dir_y;    // unit length
+    std::vector<float> quiet_s;         // seconds; 0 if unknown
+    std::vector<float> prev_x, prev_y;  // center at the start of the last tick
+};
+
+inline void BallStore_Clear (BallStore * store) {*store = {};}
+
+static inline int
+BallStore_Add (BallStore * store, Point2f const & pos, Vec2f const & dir) {
+    store->x.push_back(pos.x);
+    store->y.push_back(pos.y);
+    store->dir_x.push_back(dir.x);
+    store->dir_y.push_back(dir.y);
+    store->quiet_s.push_back(0.0f);
+    store->prev_x.push_back(pos.x);
+    store->prev_y.push_back(pos.y);
+    return store->count++;
+}
+
+inline Point2f BallStore_Pos (BallStore const * store, int i) {return {store->x[i], store->y[i]};}
+inline Vec2f BallStore_Dir (BallStore const * store, int i) {return {store->dir_x[i], store->dir_y[i]};}
+
+// Where the ball is drawn, "alpha" of the way through the last tick.
+inline Point2f BallStore_Lerp (BallStore const * store, int i, float alpha) {
+    return Lerp(Point2f{store->prev_x[i], store->prev_y[i]}, Point2f{store->x[i], store->y[i]}, alpha);
+}
+
+inline void BallStore_KeepPrevious (BallStore * store) {
+    store->prev_x = store->x;
+    store->prev_y = store->y;
+}
+
+inline void BallStore_Set (BallStore * store, int i, Point2f const & pos, Vec2f const & dir) {
+    store->x[i] = pos.x;
+    store->y[i] = pos.y;
+    store->dir_x[i] = dir.x;
+    store->dir_y[i] = dir.y;
+    store->quiet_s[i] = 0.0f;
+}
+
+// Drops every ball for which remove[i] is set, in one pass, keeping the
+// rest in order.
+static inline void
+BallStore_RemoveIf (BallStore * store, std::vector<unsigned char> const & remove) {
+    int n = 0;
+    for (int i = 0; i < store->count; ++i) {
+        if (remove[i])
+            continue;
+        store->x[n] = store->x[i];
+        store->y[n] = store->y[i];
+        store->dir_x[n] = store->dir_x[i];
+        store->dir_y[n] = store->dir_y[i];
+        store->quiet_s[n] = store->quiet_s[i];
+        store->prev_x[n] = store->prev_x[i];
+        store->prev_y[n] = store->prev_y[i];
+        ++n;
+    }
+    store->count = n;
+    store->x.resize(n);
+    store->y.resize(n);
+    store->dir_x.resize(n);
+    store->dir_y.resize(n);
+    store->quiet_s.resize(n);
+    store->prev_x.resize(n);
+    store->prev_y.resize(n);
+}
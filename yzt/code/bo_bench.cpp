@@ -0,0 +1,960 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "bo_common.hpp"
+#include "bo_math.hpp"
+#include "bo_render.hpp"
+#include "bo_drawlist.hpp"
+#include "bo_tiles.hpp"
+#include "bo_collide.hpp"
+#include "bo_env.hpp"
+#include "bo_sim.hpp"
+
+//----------------------------------------------------------------------
+// The loop Render_AAB used before it went through Render_FillSpan; kept
+// here so there's always something to compare the kernels against.
+
+static void
+Render_AAB_Baseline (Canvas * canvas, int x0, int y0, int w, int h, Color c) {
+    Color * p = canvas->pixel(x0, y0);
+    for (int i = 0; i < h; ++i, p = (Color *)((byte *)p + canvas->pitch_bytes)) {
+        Color * q = p;
+        for (int j = 0; j < w; ++q, ++j) {
+            *q = c;
+        }
+    }
+}
+
+// Render_Circle before it used cached half-widths.
+static void
+Render_Circle_Baseline (Canvas * canvas, int x, int y, int r, Color c) {
+    for (int ey = r - 1; ey > 0; --ey) {
+        int ex = int(0.5f + sqrtf(float(r * r - ey * ey)));
+        Render_LineHoriz(canvas, x - ex, x + ex, y + ey, c);
+        Render_LineHoriz(canvas, x - ex, x + ex, y - ey, c);
+    }
+    Render_LineHoriz(canvas, x - r, x + r, y, c);
+    Render_Pixel(canvas, x, y + r, c);
+    Render_Pixel(canvas, x, y - r, c);
+}
+
+// Collide_CircleAAB before it became a single swept test against the
+// rounded rectangle: four displaced edges and four corner circles.
+static CollisionResult
+Collide_CircleAAB_Baseline (
+    Point2f const & circle_pos, Real circle_radius, Vec2f const & circle_movement,   // ball_dir * ball_speed * time_step
+    Point2f const & aab_pos, Vec2f const & aab_half_dims, Vec2f const & aab_movement
+) {
+    CollisionResult ret = {};
+    //ret.param = 2.0f;   // +Inf
+    auto movement = circle_movement - aab_movement;
+    auto ball_expected = circle_pos + movement;
+
+    Point2f corners [4] = {
+        {aab_pos.x - aab_half_dims.x, aab_pos.y - aab_half_dims.y},
+        {aab_pos.x - aab_half_dims.x, aab_pos.y + aab_half_dims.y},
+        {aab_pos.x + aab_half_dims.x, aab_pos.y + aab_half_dims.y},
+        {aab_pos.x + aab_half_dims.x, aab_pos.y - aab_half_dims.y},
+    };
+    Vec2f normals [4] = {
+        {-1.0f, 0},
+        {0, +1.0f},
+        {+1.0f, 0},
+        {0, -1.0f},
+    };
+    for (int i = 0; i < 4; ++i) {
+        auto displacement = circle_radius * normals[i];
+        auto m0 = corners[i] + displacement;
+        auto m1 = corners[(i + 1) % 4] + displacement;
+        auto c = Intersect_LineLine(circle_pos, ball_expected, m0, m1);
+        if (c.exists && c.l_param > 0 && c.l_param <= 1.0f && c.m_param >= 0 && c.m_param <= 1.0f) {
+            if (!ret.exists || c.l_param < ret.param) {
+                ret.exists = true;
+                ret.param = c.l_param;
+                //ret.point = Lerp(m0, m1, c.m_param);
+                ret.point = Lerp(circle_pos, circle_pos + circle_movement, c.l_param);
+                ret.normal = normals[i];
+            }
+        }
+    }
+
+    for (int i = 0; i < 4; ++i) {
+        auto c = Intersect_LineCircle(circle_pos, ball_expected, corners[i], circle_radius);
+        if (c.count >= 2) {
+            if (c.param1 <= 0 || (c.param2 > 0 && c.param2 < c.param1))
+                c.param1 = c.param2;
+            c.count = 1;
+        }
+        if (c.count >= 1 && c.param1 > 0 && c.param1 <= 1.0f) {
+            if (!ret.exists || c.param1 < ret.param) {
+                ret.exists = true;
+                ret.param = c.param1;
+                ret.point = Lerp(circle_pos, circle_pos + circle_movement, c.param1);
+                ret.normal = Normalize(ret.point - corners[i]);
+            }
+        }
+    }
+
+    return ret;
+}
+
+static volatile float g_bench_sink;   // so results that aren't otherwise used can't be optimized away
+
+static double
+Now_s () {
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+static double g_bench_min_time_s = 0.25; // per measurement; --time changes it
+
+// Runs "op" until at least "min_time_s" has passed; returns seconds per call.
+template <typename F>
+static double
+Measure (F && op, double min_time_s = g_bench_min_time_s) {
+    op();   // warm up
+    long long reps = 0;
+    double const t0 = Now_s();
+    double t1 = t0;
+    do {
+        for (int i = 0; i < 16; ++i)
+            op();
+        reps += 16;
+        t1 = Now_s();
+    } while (t1 - t0 < min_time_s);
+    return (t1 - t0) / reps;
+}
+
+// Besides what's printed, each measurement goes in here under a name that
+// stays the same from run to run, so --json can write them all out for
+// comparing one build with another.
+struct BenchResult {
+    std::string name;
+    double ns_per_op;
+    double pixels_per_s;    // 0 where there aren't any
+    double ticks_per_s;     // the same
+};
+
+static std::vector<BenchResult> g_bench_results;
+
+static void
+Bench_Record (std::string const & name, double s_per_op, double pixels_per_op = 0, double ticks_per_op = 0) {
+    g_bench_results.push_back({name, s_per_op * 1e9, pixels_per_op / s_per_op, ticks_per_op / s_per_op});
+}
+
+static void
+Bench_JsonString (FILE * f, std::string const & str) {
+    ::fputc('"', f);
+    for (char c : str) {
+        if ('"' == c || '\\' == c)
+            ::fputc('\\', f);
+        ::fputc(c, f);
+    }
+    ::fputc('"', f);
+}
+
+// "-" is stdout.
+static bool
+Bench_WriteJson (char const * path) {
+    bool const to_stdout = 0 == ::strcmp(path, "-");
+    FILE * f = to_stdout ? stdout : ::fopen(path, "w");
+    if (!f)
+        return false;
+    ::fprintf(f, "{\n  \"cpus\": %d,\n  \"fill_kernel\": ", Platform_CPUCount());
+    Bench_JsonString(f, g_fill_kernel.name);
+    ::fprintf(f, ",\n  \"blend_kernel\": ");
+    Bench_JsonString(f, g_blend_kernel.name);
+    ::fprintf(f, ",\n  \"collide_kernel\": ");
+    Bench_JsonString(f, g_collide_kernel.name);
+    ::fprintf(f, ",\n  \"min_time_s\": %g,\n  \"results\": [", g_bench_min_time_s);
+    for (size_t i = 0; i < g_bench_results.size(); ++i) {
+        BenchResult const & r = g_bench_results[i];
+        ::fprintf(f, "%s\n    {\"name\": ", i > 0 ? "," : "");
+        Bench_JsonString(f, r.name);
+        ::fprintf(f, ", \"ns_per_op\": %.6g, \"pixels_per_s\": %.6g, \"ticks_per_s\": %.6g}",
+            r.ns_per_op, r.pixels_per_s, r.ticks_per_s);
+    }
+    ::fprintf(f, "\n  ]\n}\n");
+    return to_stdout ? 0 == ::fflush(f) : 0 == ::fclose(f);
+}
+
+struct FillCase {
+    char const * name;
+    int width, height;  // of the canvas
+    int w, h;           // of the rect being filled
+};
+
+static void
+Bench_Fill (Canvas * canvas, FillCase const & fc) {
+    FillKernel kernels [8];
+    int const kernel_count = Render_AvailableFillKernels(kernels, 8);
+
+    *canvas = Canvas_Wrap(canvas->pixels_raw, fc.width * int(sizeof(Color)), fc.width, fc.height);
+    double const bytes = double(fc.w) * fc.h * sizeof(Color);
+    // Spread narrow rects over a few rows so they don't all hit one line.
+    int const rows = fc.height - fc.h + 1;
+
+    int row = 0;
+    double const base_s = Measure([&]{
+        Render_AAB_Baseline(canvas, 0, row, fc.w, fc.h, {1, 2, 3});
+        row = (row + 1) % rows;
+    });
+    ::printf("%-18s %-8s %9.2f GB/s\n", fc.name, "baseline", bytes / base_s * 1e-9);
+    Bench_Record(std::string("Render_AAB/") + fc.name + "/baseline", base_s, double(fc.w) * fc.h);
+
+    for (int k = 0; k < kernel_count; ++k) {
+        g_fill_kernel = kernels[k];
+        row = 0;
+        double const s = Measure([&]{
+            Render_AAB(canvas, 0, row, fc.w, fc.h, {4, 5, 6});
+            row = (row + 1) % rows;
+        });
+        ::printf("%-18s %-8s %9.2f GB/s  (x%.2f)\n", fc.name, kernels[k].name, bytes / s * 1e-9, base_s / s);
+        Bench_Record(std::string("Render_AAB/") + fc.name + "/" + kernels[k].name, s, double(fc.w) * fc.h);
+    }
+}
+
+// Translucent rects of every blend mode, with each kernel, against the
+// opaque fill of the same rect.
+static void
+Bench_Blend (Canvas * canvas, FillCase const & fc) {
+    BlendKernel kernels [8];
+    int const kernel_count = Render_AvailableBlendKernels(kernels, 8);
+
+    *canvas = Canvas_Wrap(canvas->pixels_raw, fc.width * int(sizeof(Color)), fc.width, fc.height);
+    double const bytes = double(fc.w) * fc.h * sizeof(Color);
+    int const rows = fc.height - fc.h + 1;
+
+    int row = 0;
+    double const opaque_s = Measure([&]{
+        Render_AAB(canvas, 0, row, fc.w, fc.h, {4, 5, 6});
+        row = (row + 1) % rows;
+    });
+    ::printf("%-18s %-8s %-8s %9.2f GB/s\n", fc.name, "opaque", g_fill_kernel.name, bytes / opaque_s * 1e-9);
+
+    struct {char const * name; BlendMode mode;} const modes [] = {
+        {"over", BlendMode::Over}, {"add", BlendMode::Add}, {"multiply", BlendMode::Multiply},
+    };
+    BlendKernel const selected = g_blend_kernel;
+    for (auto const & m : modes)
+        for (int k = 0; k < kernel_count; ++k) {
+            g_blend_kernel = kernels[k];
+            row = 0;
+            double const s = Measure([&]{
+                Render_AAB(canvas, 0, row, fc.w, fc.h, {200, 100, 50, 128}, m.mode);
+                row = (row + 1) % rows;
+            });
+            ::printf("%-18s %-8s %-8s %9.2f GB/s  (x%.2f of opaque)\n", fc.name, m.name, kernels[k].name,
+                bytes / s * 1e-9, opaque_s / s);
+            Bench_Record(std::string("Render_AAB/") + fc.name + "/" + m.name + "/" + kernels[k].name, s, double(fc.w) * fc.h);
+        }
+    g_blend_kernel = selected;
+}
+
+static void
+Bench_Circles (Canvas * canvas, int radius) {
+    *canvas = Canvas_Wrap(canvas->pixels_raw, 800 * int(sizeof(Color)), 800, 600);
+    int const count = 500;  // balls per frame
+    int i = 0;
+    double const base_s = Measure([&]{
+        for (int j = 0; j < count; ++j, ++i)
+            Render_Circle_Baseline(canvas, 50 + i % 700, 50 + (i / 7) % 500, radius, {0, 255, 0});
+    });
+    i = 0;
+    double const s = Measure([&]{
+        for (int j = 0; j < count; ++j, ++i)
+            Render_Circle(canvas, 50 + i % 700, 50 + (i / 7) % 500, radius, {0, 255, 0});
+    });
+    ::printf("%d circles r=%-3d   baseline %8.2f ns/circle   cached spans %8.2f ns/circle  (x%.2f)\n",
+        count, radius, base_s / count * 1e9, s / count * 1e9, base_s / s);
+
+    double pixels = 0;  // in one circle; they're never clipped here
+    Render_Circle_With(canvas, 400, 300, radius, [&](Color *, int n){pixels += n;});
+    std::string const name = "Render_Circle/r=" + std::to_string(radius);
+    Bench_Record(name + "/baseline", base_s / count, pixels);
+    Bench_Record(name, s / count, pixels);
+}
+
+//----------------------------------------------------------------------
+
+static uint32_t
+Bench_Random (uint32_t * state) {
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+// Lines of about "length" pixels in every direction, all inside the
+// canvas, one by one and as a polyline through the same points.
+static void
+Bench_Lines (Canvas * canvas, int length) {
+    *canvas = Canvas_Wrap(canvas->pixels_raw, 800 * int(sizeof(Color)), 800, 600);
+    uint32_t rng = 99;
+    int const count = 512;
+    std::vector<Vec2i> points (count + 1);
+    points[0] = {400, 300};
+    double pixels = 0;
+    for (int i = 1; i <= count; ++i) {
+        float const a = float(Bench_Random(&rng) % 3600) * (3.14159265f / 1800);
+        Vec2i p = {points[i - 1].x + int(length * cosf(a)), points[i - 1].y + int(length * sinf(a))};
+        if (p.x < 0 || p.x >= 800) p.x = points[i - 1].x - (p.x - points[i - 1].x);
+        if (p.y < 0 || p.y >= 600) p.y = points[i - 1].y - (p.y - points[i - 1].y);
+        points[i] = p;
+        pixels += Max(Abs(p.x - points[i - 1].x), Abs(p.y - points[i - 1].y)) + 1;
+    }
+    double const s = Measure([&]{
+        for (int i = 1; i <= count; ++i)
+            Render_Line(canvas, points[i - 1].x, points[i - 1].y, points[i].x, points[i].y, {255, 255, 0});
+    });
+    double const poly_s = Measure([&]{Render_Polyline(canvas, points.data(), count + 1, {0, 255, 255});});
+    ::printf("%d lines of ~%-4d  Render_Line %8.2f ns/line  %8.1f Mpix/s   Render_Polyline %8.2f ns/line  (x%.2f)\n",
+        count, length, s / count * 1e9, pixels / s * 1e-6, poly_s / count * 1e9, s / poly_s);
+    std::string const name = "Render_Line/" + std::to_string(length);
+    Bench_Record(name, s / count, pixels / count);
+    Bench_Record("Render_Polyline/" + std::to_string(length), poly_s / count, pixels / count);
+}
+
+// The two intersection tests under the baseline collision, on segments a
+// ball's length or so apart, so about half of them meet.
+static void
+Bench_Intersect () {
+    uint32_t rng = 31337;
+    auto uniform = [&](float lo, float hi){return lo + (hi - lo) * float(Bench_Random(&rng) & 0xFFFF) / 65535.0f;};
+    struct Case {Point2f l0, l1, m0, m1;};
+    std::vector<Case> cases (4096);
+    for (auto & c : cases)
+        c = {{uniform(0, 50), uniform(0, 50)}, {uniform(0, 50), uniform(0, 50)},
+             {uniform(0, 50), uniform(0, 50)}, {uniform(0, 50), uniform(0, 50)}};
+    double const n = double(cases.size());
+
+    float sink = 0;
+    int line_hits = 0, circle_hits = 0;
+    for (auto const & c : cases) {
+        auto const ll = Intersect_LineLine(c.l0, c.l1, c.m0, c.m1);
+        line_hits += ll.exists && ll.l_param >= 0 && ll.l_param <= 1 && ll.m_param >= 0 && ll.m_param <= 1;
+        circle_hits += Intersect_LineCircle(c.l0, c.l1, c.m0, 10.0f).count > 0;
+    }
+    double const ll_s = Measure([&]{
+        for (auto const & c : cases)
+            sink += Intersect_LineLine(c.l0, c.l1, c.m0, c.m1).l_param;
+    });
+    double const lc_s = Measure([&]{
+        for (auto const & c : cases)
+            sink += Intersect_LineCircle(c.l0, c.l1, c.m0, 10.0f).param1;
+    });
+    ::printf("Intersect_LineLine   %6.2f ns/call  (%4.1f%% of the segments meet)\n", ll_s / n * 1e9, 100.0 * line_hits / n);
+    ::printf("Intersect_LineCircle %6.2f ns/call  (%4.1f%% of the lines hit the circle)\n", lc_s / n * 1e9, 100.0 * circle_hits / n);
+    Bench_Record("Intersect_LineLine", ll_s / n);
+    Bench_Record("Intersect_LineCircle", lc_s / n);
+    g_bench_sink = sink;
+}
+
+// One ball against one brick, with the balls spread around the brick the
+// way broad-phase candidates are (so mostly misses), or all aimed at it.
+struct CollideCase {
+    Point2f pos;
+    Vec2f movement;
+};
+
+static void
+Bench_Collide (bool aimed) {
+    uint32_t rng = 777;
+    auto uniform = [&](float lo, float hi){return lo + (hi - lo) * float(Bench_Random(&rng) & 0xFFFF) / 65535.0f;};
+    Point2f const brick = {300, 200};
+    Vec2f const half_dims = {40, 20};
+    float const radius = 10, step = 700.0f / 120;   // the game's ball, per tick
+
+    std::vector<CollideCase> cases (4096);
+    for (auto & c : cases) {
+        do {    // balls never start out inside a brick
+            c.pos = brick + Vec2f{uniform(-80, 80), uniform(-50, 50)};
+        } while (Collide_Overlaps(c.pos, radius, brick, half_dims));
+        if (aimed) {
+            c.pos = brick + Normalize({uniform(-1, 1), uniform(-1, 1)}) * 55.0f;
+            c.movement = Normalize(brick - c.pos) * 50.0f;
+        } else {
+            c.movement = Normalize({uniform(-1, 1), uniform(-1, 1)}) * step;
+        }
+    }
+
+    int hits = 0, agree = 0;
+    for (auto const & c : cases) {
+        auto a = Collide_CircleAAB_Baseline(c.pos, radius, c.movement, brick, half_dims, {0, 0});
+        auto b = Collide_CircleAAB(c.pos, radius, c.movement, brick, half_dims, {0, 0});
+        hits += a.exists;
+        agree += a.exists == b.exists && (!a.exists || (Abs(a.param - b.param) < 1e-4f && LengthSq(a.normal - b.normal) < 1e-6f));
+    }
+
+    float sink = 0;
+    double const base_s = Measure([&]{
+        for (auto const & c : cases)
+            sink += Collide_CircleAAB_Baseline(c.pos, radius, c.movement, brick, half_dims, {0, 0}).param;
+    });
+    double const s = Measure([&]{
+        for (auto const & c : cases)
+            sink += Collide_CircleAAB(c.pos, radius, c.movement, brick, half_dims, {0, 0}).param;
+    });
+    double const n = double(cases.size());
+    ::printf("circle vs brick, %-7s (%4.1f%% hits)  baseline %6.2f ns/call   swept rounded rect %6.2f ns/call  (x%.2f)  agree %d/%d\n",
+        aimed ? "aimed" : "nearby", 100.0 * hits / n, base_s / n * 1e9, s / n * 1e9, base_s / s,
+        agree, int(cases.size()));
+    Bench_Record(std::string("Collide_CircleAAB/") + (aimed ? "aimed" : "nearby") + "/baseline", base_s / n);
+    Bench_Record(std::string("Collide_CircleAAB/") + (aimed ? "aimed" : "nearby"), s / n);
+    g_bench_sink = sink;
+}
+
+// The batched narrow phase: one ball against "count" bricks scattered
+// around it, with every kernel, against calling Collide_CircleAAB() per
+// brick and keeping the earliest (lowest index on ties.)
+static void
+Bench_CollideBatch (int count) {
+    uint32_t rng = 4242;
+    auto uniform = [&](float lo, float hi){return lo + (hi - lo) * float(Bench_Random(&rng) & 0xFFFF) / 65535.0f;};
+    float const extent = 60.0f * sqrtf(float(count));  // about as dense as the game's wall
+    std::vector<float> x (count), y (count), half_w (count), half_h (count);
+    for (int i = 0; i < count; ++i) {
+        x[i] = uniform(0, extent); y[i] = uniform(0, extent);
+        half_w[i] = uniform(10, 40); half_h[i] = uniform(5, 20);
+    }
+    BrickBatch const batch = {x.data(), y.data(), half_w.data(), half_h.data(), count};
+
+    std::vector<CollideCase> cases (256);
+    for (auto & c : cases) {
+        c.pos = {uniform(0, extent), uniform(0, extent)};
+        c.movement = Normalize({uniform(-1, 1), uniform(-1, 1)}) * 50.0f;
+    }
+    float const radius = 10;
+
+    std::vector<int> expected (cases.size());
+    int hits = 0;
+    for (size_t k = 0; k < cases.size(); ++k) {
+        int best = -1;
+        Real best_t = 0;
+        for (int i = 0; i < count; ++i) {
+            auto c = Collide_CircleAAB(cases[k].pos, radius, cases[k].movement, {x[i], y[i]}, {half_w[i], half_h[i]}, {0, 0});
+            if (c.exists && (best < 0 || c.param < best_t)) {best = i; best_t = c.param;}
+        }
+        expected[k] = best;
+        hits += best >= 0;
+    }
+
+    int sink = 0;
+    double const n = double(cases.size()) * count;
+    double const base_s = Measure([&]{
+        for (auto const & c : cases)
+            for (int i = 0; i < count; ++i)
+                sink += Collide_CircleAAB(c.pos, radius, c.movement, {x[i], y[i]}, {half_w[i], half_h[i]}, {0, 0}).exists;
+    });
+    ::printf("ball vs %4d bricks (%3d/%d hit)  per-brick %6.2f ns/brick", count, hits, int(cases.size()), base_s / n * 1e9);
+    std::string const name = "Collide_CircleBricks/" + std::to_string(count);
+    Bench_Record(name + "/per-brick", base_s / n);
+
+    CollideKernel kernels [8];
+    int const kernel_count = Collide_AvailableKernels(kernels, 8);
+    for (int j = 0; j < kernel_count; ++j) {
+        bool identical = true;
+        for (size_t k = 0; k < cases.size(); ++k)
+            identical &= kernels[j].func(cases[k].pos, radius, cases[k].movement, batch) == expected[k];
+        double const s = Measure([&]{
+            for (auto const & c : cases)
+                sink += kernels[j].func(c.pos, radius, c.movement, batch);
+        });
+        ::printf("   %s %6.2f (x%.2f)%s", kernels[j].name, s / n * 1e9, base_s / s, identical ? "" : " MISMATCH");
+        Bench_Record(name + "/" + kernels[j].name, s / n);
+    }
+    ::printf("\n");
+    g_bench_sink = float(sink);
+}
+
+// The thread counts to try: powers of two, and then every core, however
+// many there are.
+static std::vector<int>
+Bench_ThreadCounts () {
+    int const max_threads = Platform_CPUCount();
+    std::vector<int> ret;
+    for (int threads = 1; threads < max_threads; threads *= 2)
+        ret.push_back(threads);
+    ret.push_back(max_threads);
+    return ret;
+}
+
+// A busy, deterministic frame: a clear, a brick wall, and a lot of balls
+// and lines on top of it.
+static void
+Bench_BuildScene (DrawList * list, int width, int height) {
+    uint32_t rng = 12345;
+    DrawList_Reset(list);
+    DrawList_Clear(list, {0, 0, 0});
+    for (int y = 40; y + 40 < height / 2; y += 44)
+        for (int x = 48; x + 80 < width; x += 84)
+            DrawList_AAB(list, x, y, 80, 40, {50, 50, 250});
+    for (int i = 0; i < 100; ++i)
+        DrawList_Line(list,
+            int(Bench_Random(&rng) % width), int(Bench_Random(&rng) % height),
+            int(Bench_Random(&rng) % width), int(Bench_Random(&rng) % height),
+            {255, 255, 0});
+    for (int i = 0; i < 500; ++i) {
+        int x = int(Bench_Random(&rng) % width), y = int(Bench_Random(&rng) % height);
+        DrawList_Line(list, x, y,
+            x + int(Bench_Random(&rng) % 81) - 40, y + int(Bench_Random(&rng) % 81) - 40,
+            {0, 255, 255});
+    }
+    for (int i = 0; i < 500; ++i)
+        DrawList_Circle(list,
+            int(Bench_Random(&rng) % width), int(Bench_Random(&rng) % height),
+            int(2 + Bench_Random(&rng) % 30), {0, 255, 0});
+}
+
+static void
+Bench_Tiled (int width, int height) {
+    Canvas canvas = Canvas_Alloc(width, height);
+    DrawList list = {};
+    DrawList_Init(&list, 4096);
+    Bench_BuildScene(&list, width, height);
+    Rect const everything = Canvas_Bounds(&canvas);
+    double const pixels = double(width) * height;
+
+    double const serial_s = Measure([&]{DrawList_Execute(&canvas, &list);});
+    uint64_t const serial_hash = Canvas_Hash(&canvas);
+    ::printf("scene %dx%d (%d cmds)  serial     %8.3f ms  %8.1f Mpix/s\n",
+        width, height, list.count, serial_s * 1e3, pixels / serial_s * 1e-6);
+    std::string const name = "scene/" + std::to_string(width) + "x" + std::to_string(height);
+    Bench_Record(name + "/serial", serial_s, pixels);
+
+    for (int threads : Bench_ThreadCounts()) {
+        JobPool pool;
+        JobPool_Start(&pool, threads);
+        TiledRenderer tr;
+        TiledRenderer_Init(&tr, &pool);
+
+        ::memset(canvas.pixels_raw, 0xCD, size_t(canvas.pitch_bytes) * height);
+        double const s = Measure([&]{TiledRenderer_Execute(&tr, &canvas, &list, &everything, 1);});
+        bool const identical = Canvas_Hash(&canvas) == serial_hash;
+        ::printf("scene %dx%d (%d cmds)  tiled x%-3d %8.3f ms  %8.1f Mpix/s  (x%.2f)%s\n",
+            width, height, list.count, threads, s * 1e3, pixels / s * 1e-6, serial_s / s,
+            identical ? "" : "  OUTPUT DIFFERS FROM SERIAL!");
+        Bench_Record(name + "/tiled x" + std::to_string(threads), s, pixels);
+
+        JobPool_Stop(&pool);
+    }
+
+    DrawList_Free(&list);
+    Canvas_Free(&canvas);
+}
+
+// A frame with "count" bricks in it, drawn brick by brick and then as one
+// pre-rendered layer; the latter shouldn't care how many bricks there are.
+static void
+Bench_BrickLayer (int width, int height, int count) {
+    Canvas canvas = Canvas_Alloc(width, height);
+    Canvas layer = Canvas_Alloc(width, height);
+    DrawList list = {};
+    DrawList_Init(&list, count + 16);
+
+    int const cols = Max(1, width / 20);
+    auto record_bricks = [&]{
+        DrawList_Reset(&list);
+        DrawList_Clear(&list, {0, 0, 0});
+        for (int i = 0; i < count; ++i)
+            DrawList_AAB(&list, (i % cols) * 20, ((i / cols) * 10) % height, 18, 8, {50, 50, 250});
+    };
+    record_bricks();
+    DrawList_Execute(&layer, &list);
+
+    // Once over the whole frame, and once over a ball-sized dirty rect,
+    // which is what the game usually redraws.
+    Rect const dirty_cases [] = {Canvas_Bounds(&canvas), {width / 2, height / 2, width / 2 + 24, height / 2 + 24}};
+    for (Rect const & dirty : dirty_cases) {
+        Canvas_SetClip(&canvas, dirty);
+        DrawList_SetLayer(&list, 0, nullptr);
+        double const bricks_s = Measure([&]{
+            record_bricks();
+            DrawList_Execute(&canvas, &list);
+        });
+        uint64_t const bricks_hash = Canvas_Hash(&canvas);
+
+        DrawList_SetLayer(&list, 0, &layer);
+        double const layer_s = Measure([&]{
+            DrawList_Reset(&list);
+            DrawList_Layer(&list, 0);
+            DrawList_Execute(&canvas, &list);
+        });
+        bool const identical = Canvas_Hash(&canvas) == bricks_hash;
+        ::printf("%dx%d %6d bricks, dirty %4dx%-4d  each brick %9.4f ms   layer %9.4f ms  (x%.2f)%s\n",
+            width, height, count, dirty.x1 - dirty.x0, dirty.y1 - dirty.y0, bricks_s * 1e3, layer_s * 1e3,
+            bricks_s / layer_s, identical ? "" : "  OUTPUT DIFFERS!");
+        double const dirty_pixels = double(dirty.x1 - dirty.x0) * (dirty.y1 - dirty.y0);
+        std::string const name = "bricks/" + std::to_string(count) + "/dirty " + std::to_string(dirty.x1 - dirty.x0) + "x" + std::to_string(dirty.y1 - dirty.y0);
+        Bench_Record(name + "/each brick", bricks_s, dirty_pixels);
+        Bench_Record(name + "/layer", layer_s, dirty_pixels);
+    }
+
+    DrawList_Free(&list);
+    Canvas_Free(&layer);
+    Canvas_Free(&canvas);
+}
+
+// Plays "count" games for "steps" steps both as one batch and each on its
+// own Sim, with the same actions (the autopilot's, with a random one
+// every so often), and compares the paddle, the ball and the bricks after
+// every step; a game stops being compared once its episode is over.
+// Returns the number of games that went differently.
+static int
+Bench_EnvCheck (int count, int steps) {
+    EnvConfig config;
+    config.envs_per_job = 64;   // so there's more than one job
+    config.ticks_per_step = 7;
+    JobPool pool;
+    JobPool_Start(&pool, Platform_CPUCount());
+    EnvBatch env;
+    EnvBatch_Init(&env, config, count, &pool);
+    std::vector<Sim> sims (count);
+    for (Sim & sim : sims) {
+        Sim_Init(&sim, config.sim, nullptr);
+        Sim_Tick(&sim, SimInput{});     // puts the ball on the paddle, where a batch game starts
+    }
+
+    std::vector<byte> actions (count);
+    std::vector<byte> compared (count, 1);
+    uint32_t rng = 2024;
+    int differ = 0;
+    for (int step = 0; step < steps; ++step) {
+        EnvBatch_Autopilot(&env, actions.data());
+        for (byte & a : actions)
+            if (Bench_Random(&rng) % 8 == 0)
+                a = byte(Bench_Random(&rng) % EnvAction_Count);
+
+        for (int i = 0; i < count; ++i) {
+            if (!compared[i])
+                continue;
+            SimInput input;
+            input.movement = (EnvAction_Left == actions[i] ? -1.0f : EnvAction_Right == actions[i] ? 1.0f : 0.0f);
+            input.serve = EnvAction_Serve == actions[i];
+            Sim_Act(&sims[i], input);
+            input.serve = false;
+            for (int t = 0; t < config.ticks_per_step; ++t)
+                Sim_Tick(&sims[i], input);
+            sims[i].removed.clear();
+        }
+        EnvBatch_Step(&env, actions.data(), nullptr);
+
+        for (int i = 0; i < count; ++i) {
+            if (!compared[i])
+                continue;
+            if (env.done[i]) {
+                compared[i] = 0;
+                continue;
+            }
+            Sim const & sim = sims[i];
+            uint64_t bricks = 0;
+            for (int slot = 0; slot < int(sim.bricks.index_of.size()); ++slot)
+                if (sim.bricks.index_of[slot] >= 0)
+                    bricks |= 1ULL << slot;
+            bool const same = 1 == sim.state.balls.count
+                && sim.state.paddle_pos.x == env.paddle_x[i]
+                && sim.state.balls.x[0] == env.ball_x[i] && sim.state.balls.y[0] == env.ball_y[i]
+                && sim.state.balls.dir_x[0] == env.dir_x[i] && sim.state.balls.dir_y[0] == env.dir_y[i]
+                && bricks == env.bricks[i];
+            if (!same) {
+                differ += 1;
+                compared[i] = 0;
+            }
+        }
+    }
+    JobPool_Stop(&pool);
+    return differ;
+}
+
+// "count" games stepped as one batch, against the same games each run on
+// their own Sim; the batch should be a lot cheaper per game. The Sims
+// don't draw anything, so the runs that also render the observations
+// aren't compared against them.
+static void
+Bench_Env (int count) {
+    EnvConfig config;
+    int const differ = Bench_EnvCheck(256, 3000);
+    ::printf("%5d games, %d ticks a step  batch against Sim: %s\n",
+        256, 7, differ ? "GAMES DIFFER FROM SIM!" : "identical");
+
+    std::vector<byte> actions (count), obs;
+    std::vector<Sim> sims (count);
+    for (Sim & sim : sims)
+        Sim_Init(&sim, config.sim, nullptr);
+    double const sims_s = Measure([&]{
+        for (Sim & sim : sims) {
+            SimInput input = Sim_Autopilot(&sim);
+            Sim_Act(&sim, input);
+            for (int t = 0; t < config.ticks_per_step; ++t)
+                Sim_Tick(&sim, input);
+            sim.removed.clear();
+        }
+    });
+    ::printf("%5d games, %d ticks a step  one Sim each     %9.1f ns/game-step\n",
+        count, config.ticks_per_step, sims_s / count * 1e9);
+    std::string const name = "EnvBatch/" + std::to_string(count);
+    Bench_Record(name + "/one Sim each", sims_s / count, 0, config.ticks_per_step);
+
+    for (int threads : Bench_ThreadCounts()) {
+        JobPool pool;
+        JobPool_Start(&pool, threads);
+        for (bool render : {false, true}) {
+            EnvBatch env;
+            EnvBatch_Init(&env, config, count, &pool);
+            obs.resize(render ? count * EnvBatch_ObsSize(&env) : 0);
+            double const s = Measure([&]{
+                EnvBatch_Autopilot(&env, actions.data());
+                EnvBatch_Step(&env, actions.data(), render ? obs.data() : nullptr);
+            });
+            char ratio [32] = "";
+            if (!render)
+                ::snprintf(ratio, sizeof(ratio), "x%.1f, ", sims_s / s);
+            ::printf("%5d games, %d ticks a step  batch x%-3d%s  %9.1f ns/game-step  (%s%.1f%% slow ticks)\n",
+                count, config.ticks_per_step, threads, render ? " +obs" : "     ", s / count * 1e9, ratio,
+                env.slow_ball_ticks / env.ball_ticks * 100);
+            Bench_Record(name + (render ? "/obs" : "") + "/batch x" + std::to_string(threads), s / count, 0, config.ticks_per_step);
+        }
+        JobPool_Stop(&pool);
+    }
+}
+
+//----------------------------------------------------------------------
+// Whole games. A level is the game's own wall of 48 bricks, or "bricks"
+// small ones filling the top of a 1920x1080 field.
+
+static void
+Bench_InitLevel (Sim * sim, SimConfig config, int bricks, int balls) {
+    config.serve_balls = balls;
+    if (bricks <= 0) {
+        Sim_Init(sim, config, nullptr);
+        return;
+    }
+    config.width = 1920;
+    config.height = 1080;
+    config.brick_half_dims = {6, 3};
+    Sim_Init(sim, config, nullptr);
+    BrickStore_Clear(&sim->bricks);
+    SpatialGrid_Init(&sim->grid, {0.0f, 0.0f}, {float(config.width), float(config.height)}, 2.0f * config.brick_half_dims);
+    int const cols = (config.width - 16) / 14;
+    for (int i = 0; i < bricks; ++i)
+        Sim_AddBrick(&sim->bricks, &sim->grid, {14.0f + 14.0f * (i % cols), 40.0f + 8.0f * (i / cols)}, config.brick_half_dims, config.brick_color);
+}
+
+// Plays "ticks" ticks of a fresh game on autopilot, over and over; only
+// the ticks are timed. Then draws its last frame, the way the game does
+// when everything is dirty (but without the brick layer.)
+static void
+Bench_Level (char const * name, int bricks, int balls, int ticks) {
+    Sim sim;
+    double tick_s = 0;
+    int runs = 0;
+    uint64_t hash = 0;
+    do {
+        Bench_InitLevel(&sim, SimConfig{}, bricks, balls);
+        double const t0 = Now_s();
+        for (int t = 0; t < ticks; ++t) {
+            SimInput const input = Sim_Autopilot(&sim);
+            Sim_Act(&sim, input);
+            Sim_Tick(&sim, input);
+            sim.removed.clear();
+        }
+        tick_s += Now_s() - t0;
+        runs += 1;
+        hash = Sim_Hash(&sim);
+    } while (tick_s < g_bench_min_time_s || runs < 3);
+    tick_s /= double(runs) * ticks;
+
+    SimConfig const & c = sim.config;
+    Canvas canvas = Canvas_Alloc(c.width, c.height);
+    DrawList list = {};
+    DrawList_Init(&list, sim.bricks.count + sim.state.balls.count + 16);
+    double const draw_s = Measure([&]{
+        DrawList_Reset(&list);
+        DrawList_Clear(&list, {0, 0, 0});
+        for (int i = 0; i < sim.bricks.count; ++i)
+            DrawList_AAB(&list, BrickStore_Rect(&sim.bricks, i), sim.bricks.color[i]);
+        Point2f const paddle = sim.state.paddle_pos;
+        DrawList_AAB(&list, Round(paddle.x - c.paddle_half_dims.x), Round(paddle.y - c.paddle_half_dims.y),
+            Round(2 * c.paddle_half_dims.x), Round(2 * c.paddle_half_dims.y), {255, 0, 0});
+        for (int b = 0; b < sim.state.balls.count; ++b)
+            DrawList_Circle(&list, Round(sim.state.balls.x[b]), Round(sim.state.balls.y[b]), Round(c.ball_radius), {0, 255, 0});
+        DrawList_Execute(&canvas, &list);
+    });
+    double const pixels = double(c.width) * c.height;
+    ::printf("%-24s %6d ticks  %10.0f ticks/s  %9.1f ns/tick  (%d bricks, %d balls left; hash %016llx)   frame %8.3f ms  %8.1f Mpix/s\n",
+        name, ticks, 1 / tick_s, tick_s * 1e9, sim.bricks.count, sim.state.balls.count, (unsigned long long)hash,
+        draw_s * 1e3, pixels / draw_s * 1e-6);
+    Bench_Record(std::string("level/") + name + "/tick", tick_s, 0, 1);
+    Bench_Record(std::string("level/") + name + "/frame", draw_s, pixels);
+
+    DrawList_Free(&list);
+    Canvas_Free(&canvas);
+}
+
+// The ball's trail with DRAW_BALL_HISTORY on: a line from each point to
+// the next and a dot on each, all redrawn every frame. The points are a
+// real game's, one per tick.
+static void
+Bench_Trail (int points) {
+    Sim sim;
+    std::vector<Point2f> trail;
+    Bench_InitLevel(&sim, SimConfig{}, 0, 1);
+    sim.trail = &trail;
+    while (int(trail.size()) < points) {
+        SimInput const input = Sim_Autopilot(&sim);
+        Sim_Act(&sim, input);
+        Sim_Tick(&sim, input);
+        sim.removed.clear();
+    }
+    trail.resize(points);
+
+    Canvas canvas = Canvas_Alloc(sim.config.width, sim.config.height);
+    DrawList list = {};
+    DrawList_Init(&list, 2 * points + 16);
+    double const s = Measure([&]{
+        DrawList_Reset(&list);
+        DrawList_Clear(&list, {0, 0, 0});
+        for (int i = 1; i < points; ++i)
+            DrawList_Line(&list, Round(trail[i - 1].x), Round(trail[i - 1].y), Round(trail[i].x), Round(trail[i].y), {0, 255, 255});
+        for (auto const & p : trail)
+            DrawList_Circle(&list, Round(p.x), Round(p.y), 2, {0, 255, 255});
+        DrawList_Execute(&canvas, &list);
+    });
+    ::printf("trail of %6d points  %8.3f ms/frame  %7.1f ns/point\n", points, s * 1e3, s / points * 1e9);
+    Bench_Record("trail/" + std::to_string(points) + "/frame", s, double(canvas.width) * canvas.height);
+
+    DrawList_Free(&list);
+    Canvas_Free(&canvas);
+}
+
+// Times a draw list captured from the game (F12) or anywhere else.
+static int
+Bench_Replay (char const * path) {
+    DrawList list = {};
+    DrawList_Init(&list, 256);
+    int width = 0, height = 0;
+    if (!DrawList_Load(&list, &width, &height, path) || width <= 0 || height <= 0) {
+        ::fprintf(stderr, "Couldn't read a draw list from \"%s\".\n", path);
+        return 1;
+    }
+    Canvas canvas = Canvas_Alloc(width, height);
+    double const pixels = double(width) * height;
+
+    double const raw_s = Measure([&]{DrawList_Execute(&canvas, &list);});
+    uint64_t const raw_hash = Canvas_Hash(&canvas);
+    ::printf("replay %s (%dx%d, %d cmds)  as recorded %8.3f ms  %8.1f Mpix/s\n",
+        path, width, height, list.count, raw_s * 1e3, pixels / raw_s * 1e-6);
+
+    int const removed = DrawList_Optimize(&list, Canvas_Bounds(&canvas));
+    double const opt_s = Measure([&]{DrawList_Execute(&canvas, &list);});
+    bool const identical = Canvas_Hash(&canvas) == raw_hash;
+    ::printf("replay %s (%dx%d, %d cmds)  optimized   %8.3f ms  %8.1f Mpix/s  (%d cmds removed)%s\n",
+        path, width, height, list.count, opt_s * 1e3, pixels / opt_s * 1e-6, removed,
+        identical ? "" : "  OUTPUT DIFFERS!");
+
+    Canvas_Free(&canvas);
+    DrawList_Free(&list);
+    return identical ? 0 : 1;
+}
+
+int main (int argc, char * argv []) {
+    Render_Init();
+    Collide_Init();
+    if (argc >= 3 && 0 == ::strcmp(argv[1], "--replay")) {
+        int ret = 0;
+        for (int i = 2; i < argc; ++i)
+            ret |= Bench_Replay(argv[i]);
+        return ret;
+    }
+    char const * json_path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        bool const has_value = i + 1 < argc;
+        if (0 == ::strcmp(argv[i], "--json") && has_value) {
+            json_path = argv[++i];
+        } else if (0 == ::strcmp(argv[i], "--time") && has_value) {
+            g_bench_min_time_s = std::max(0.001, ::atof(argv[++i]));
+        } else {
+            ::fprintf(stderr,
+                "usage: %s [--json file] [--time seconds]\n"
+                "       %s --replay file...\n"
+                "  --json     also write every result into \"file\" (\"-\" for stdout), as JSON\n"
+                "  --time     how long each measurement runs for at least (default: 0.25)\n"
+                "  --replay   time draw lists captured with F12 in the game instead\n",
+                argv[0], argv[0]);
+            return 1;
+        }
+    }
+
+    int const max_w = 3840, max_h = 2160;
+    std::vector<uint32_t> storage (size_t(max_w) * max_h);
+    Canvas canvas = {};
+    canvas.pixels_raw = storage.data();
+
+    FillCase const cases [] = {
+        {"span 16",        800,  600,   16,    1},
+        {"span 100",       800,  600,  100,    1},
+        {"span 800",       800,  600,  800,    1},
+        {"brick 80x40",    800,  600,   80,   40},
+        {"clear 600x800",  600,  800,  600,  800},
+        {"clear 1920x1080", 1920, 1080, 1920, 1080},
+        {"clear 3840x2160", 3840, 2160, 3840, 2160},
+    };
+
+    FillKernel const selected = g_fill_kernel;
+    ::printf("fill kernel selected at startup: %s\n\n", selected.name);
+    for (auto const & fc : cases)
+        Bench_Fill(&canvas, fc);
+    g_fill_kernel = selected;
+
+    ::printf("\nblend kernel selected at startup: %s\n\n", g_blend_kernel.name);
+    for (int i : {1, 3, 5})
+        Bench_Blend(&canvas, cases[i]);
+
+    ::printf("\n");
+    for (int r : {2, 10, 40})
+        Bench_Circles(&canvas, r);
+    for (int length : {8, 100, 500})
+        Bench_Lines(&canvas, length);
+
+    ::printf("\n");
+    Bench_Collide(false);
+    Bench_Collide(true);
+    Bench_Intersect();
+    ::printf("\ncollide kernel selected at startup: %s\n\n", g_collide_kernel.name);
+    for (int n : {8, 64, 1024})
+        Bench_CollideBatch(n);
+
+    ::printf("\n");
+    for (int n : {48, 1000, 10000})
+        Bench_BrickLayer(1920, 1080, n);
+
+    ::printf("\n");
+    Bench_Env(4096);
+
+    ::printf("\n");
+    Bench_Level("48 bricks", 0, 1, 20000);
+    Bench_Level("48 bricks, 1000 balls", 0, 1000, 2000);
+    Bench_Level("10000 bricks", 10000, 1, 20000);
+    Bench_Level("10000 bricks, 100 balls", 10000, 100, 5000);
+    for (int n : {1000, 10000, 100000})
+        Bench_Trail(n);
+
+    ::printf("\n");
+    Bench_Tiled(600, 800);
+    Bench_Tiled(1920, 1080);
+    Bench_Tiled(3840, 2160);
+
+    // Touch the result so none of the above can be thrown away.
+    uint32_t sum = 0;
+    for (auto v : storage)
+        sum += v;
+    ::printf("\nchecksum %08x\n", sum);
+
+    if (json_path && !Bench_WriteJson(json_path)) {
+        ::fprintf(stderr, "Couldn't write \"%s\".\n", json_path);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "bo_common.hpp"
+#include "bo_math.hpp"
+#include "bo_render.hpp"
+#include <vector>
+
+// The bricks, as structure-of-arrays. Live bricks are always packed into
+// [0, count), so collision and rendering just walk plain arrays, and
+// removing one moves the last brick into its place.
+//
+// Every brick also has a slot, which doesn't change for as long as it's
+// alive; that's what the spatial grid and handles refer to. A handle
+// carries the slot's generation too, so one that outlives its brick (and
+// whatever later got the same slot) is simply not found.
+
+struct BrickHandle {
+    int slot;
+    uint32_t generation;
+};
+
+struct BrickStore {
+    int count;
+
+    // Dense; indexed by [0, count).
+    std::vector<float> x, y;            // center
+    std::vector<float> half_w, half_h;
+    std::vector<Color> color;
+    std::vector<int> slot_of;
+
+    // Per slot.
+    std::vector<int> index_of;          // -1 if the slot is free
+    std::vector<uint32_t> generation;
+    std::vector<int> free_slots;
+};
+
+inline void BrickStore_Clear (BrickStore * store) {*store = {};}
+
+static inline int
+BrickStore_Add (BrickStore * store, Point2f const & center, Vec2f const & half_dims, Color c) {
+    int slot;
+    if (store->free_slots.empty()) {
+        slot = int(store->index_of.size());
+        store->index_of.push_back(-1);
+        store->generation.push_back(0);
+    } else {
+        slot = store->free_slots.back();
+        store->free_slots.pop_back();
+    }
+    store->index_of[slot] = store->count++;
+    store->x.push_back(center.x);
+    store->y.push_back(center.y);
+    store->half_w.push_back(half_dims.x);
+    store->half_h.push_back(half_dims.y);
+    store->color.push_back(c);
+    store->slot_of.push_back(slot);
+    return slot;
+}
+
+static inline void
+BrickStore_Remove (BrickStore * store, int slot) {
+    ASSERT(slot >= 0 && slot < int(store->index_of.size()) && store->index_of[slot] >= 0);
+    int const i = store->index_of[slot];
+    int const last = --store->count;
+    if (i != last) {
+        store->x[i] = store->x[last];
+        store->y[i] = store->y[last];
+        store->half_w[i] = store->half_w[last];
+        store->half_h[i] = store->half_h[last];
+        store->color[i] = store->color[last];
+        store->slot_of[i] = store->slot_of[last];
+        store->index_of[store->slot_of[i]] = i;
+    }
+    store->x.pop_back();
+    store->y.pop_back();
+    store->half_w.pop_back();
+    store->half_h.pop_back();
+    store->color.pop_back();
+    store->slot_of.pop_back();
+
+    store->index_of[slot] = -1;
+    store->generation[slot] += 1;
+    store->free_slots.push_back(slot);
+}
+
+inline Point2f BrickStore_Center (BrickStore const * store, int i) {return {store->x[i], store->y[i]};}
+inline Vec2f BrickStore_HalfDims (BrickStore const * store, int i) {return {store->half_w[i], store->half_h[i]};}
+
+// Exactly the pixels Render_AAB() touches for brick "i" (a dense index.)
+inline Rect BrickStore_Rect (BrickStore const * store, int i) {
+    return Rect_OfAAB(
+        Round(store->x[i] - store->half_w[i]), Round(store->y[i] - store->half_h[i]),
+        Round(2 * store->half_w[i]), Round(2 * store->half_h[i])
+    );
+}
+
+inline BrickHandle BrickStore_Handle (BrickStore const * store, int slot) {return {slot, store->generation[slot]};}
+
+// The dense index of the brick, or -1 if it's gone.
+inline int BrickStore_Find (BrickStore const * store, BrickHandle h) {
+    bool const valid = h.slot >= 0 && h.slot < int(store->index_of.size()) && store->generation[h.slot] == h.generation;
+    return valid ? store->index_of[h.slot] : -1;
+}
@@ -0,0 +1,516 @@
+#pragma once
+
+#include "bo_common.hpp"
+#include "bo_math.hpp"
+#include "bo_platform.hpp"
+#include <limits>
+
+struct CollisionResult {
+    bool exists;
+    Real param;
+    Point2f point;
+    Vec2f normal;
+};
+
+// Whether a circle and a box overlap right now (touching counts.)
+inline bool Collide_Overlaps (Point2f const & circle_pos, Real circle_radius, Point2f const & aab_pos, Vec2f const & aab_half_dims) {
+    Vec2f const d = circle_pos - aab_pos;
+    Vec2f const outside = {Max(Abs(d.x) - aab_half_dims.x, 0.0f), Max(Abs(d.y) - aab_half_dims.y, 0.0f)};
+    return LengthSq(outside) <= Sqr(circle_radius);
+}
+
+//----------------------------------------------------------------------
+// A moving circle against a moving box is a point (the circle's center)
+// against the box grown by the radius: a rounded rectangle, made of four
+// flat faces and four quarter-circles around the box's corners. All of it
+// is inside the box grown by the radius in x and y, so one slab test
+// against that rejects nearly everything, and when the path does go in,
+// where it goes in says whether it's a face or which one corner circle to
+// solve for.
+//
+// The result is what the old "four displaced edges and four corner
+// circles" test gave: the first crossing in (0, 1] of the movement, with
+// "point" along the circle's own (not the relative) movement and corner
+// normals taken from that point. A circle that starts out overlapping the
+// box gets the same answer too, by looking at every face and corner.
+
+// The first root in (0, 1] of |d + m * t| = r, as Intersect_LineCircle()
+// and the code that used it would have picked it; or 0 if there's none.
+static inline Real
+Collide_CornerParam (Vec2f const & d, Vec2f const & m, Real r) {
+    Real const mm = Dot(m, m);
+    if (AlmostZero(mm))
+        return 0;
+    Real const dm = Dot(d, m);
+    Real const delta_quarter = Sqr(dm) - mm * Dot(d, d) + mm * Sqr(r);
+    Real t;
+    if (AlmostZero(delta_quarter)) {
+        t = -dm / mm;
+    } else if (delta_quarter > 0) {
+        Real const s = Sqrt(delta_quarter);
+        t = (-dm - s) / mm;
+        if (t <= 0)
+            t = (-dm + s) / mm;
+    } else {
+        return 0;
+    }
+    return (t > 0 && t <= 1.0f) ? t : 0;
+}
+
+static inline CollisionResult
+Collide_CircleAAB (
+    Point2f const & circle_pos, Real circle_radius, Vec2f const & circle_movement,   // ball_dir * ball_speed * time_step
+    Point2f const & aab_pos, Vec2f const & aab_half_dims, Vec2f const & aab_movement
+) {
+    CollisionResult ret = {};
+    Real const R = circle_radius;
+    Vec2f const h = aab_half_dims;
+    Vec2f const e = h + R;
+    Vec2f const m = circle_movement - aab_movement;
+    Vec2f const p = circle_pos - aab_pos;       // everything's relative to the box center from here on
+
+    // Slab test. "enter_axis" is the one whose slab was entered last.
+    Real const inf = std::numeric_limits<Real>::infinity();
+    Real t_enter = -inf, t_exit = inf;
+    int enter_axis = -1;
+    Real const pc [2] = {p.x, p.y}, mc [2] = {m.x, m.y}, ec [2] = {e.x, e.y};
+    for (int a = 0; a < 2; ++a) {
+        if (mc[a] == 0) {
+            if (pc[a] < -ec[a] || pc[a] > ec[a])
+                return ret;
+            continue;
+        }
+        Real const inv = 1.0f / mc[a];
+        Real t0 = (-ec[a] - pc[a]) * inv, t1 = (ec[a] - pc[a]) * inv;
+        if (t0 > t1) {Real t = t0; t0 = t1; t1 = t;}
+        if (t0 > t_enter) {t_enter = t0; enter_axis = a;}
+        if (t1 < t_exit) t_exit = t1;
+    }
+    if (t_enter > t_exit || t_exit <= 0 || t_enter > 1.0f)
+        return ret;
+
+    auto hit = [&](Real t, Vec2f const & normal) {
+        ret.exists = true;
+        ret.param = t;
+        ret.point = Lerp(circle_pos, circle_pos + circle_movement, t);
+        ret.normal = normal;
+    };
+    auto hit_corner = [&](Real t, Vec2f const & corner) {
+        hit(t, {});
+        ret.normal = Normalize(ret.point - (aab_pos + corner));
+    };
+
+    // Starting outside the box: the first thing crossed is where the path
+    // goes into the rounded rectangle, through the flat part of a face, or
+    // else through the corner circle of the corner region it came in at.
+    if (t_enter > 0) {
+        Vec2f const q = p + m * t_enter;
+        if (0 == enter_axis && Abs(q.y) <= h.y && !AlmostZero(m.x * 2 * h.y)) {
+            hit(t_enter, {m.x > 0 ? -1.0f : +1.0f, 0.0f});
+        } else if (1 == enter_axis && Abs(q.x) <= h.x && !AlmostZero(m.y * 2 * h.x)) {
+            hit(t_enter, {0.0f, m.y > 0 ? -1.0f : +1.0f});
+        } else {
+            Vec2f const corner = {q.x < 0 ? -h.x : h.x, q.y < 0 ? -h.y : h.y};
+            Real const t = Collide_CornerParam(p - corner, m, R);
+            if (t > 0)
+                hit_corner(t, corner);
+        }
+        return ret;
+    }
+
+    // Starting in one of the corner regions of the box, outside the circle;
+    // only that circle can be in the way.
+    if (Abs(p.x) > h.x && Abs(p.y) > h.y) {
+        Vec2f const corner = {p.x < 0 ? -h.x : h.x, p.y < 0 ? -h.y : h.y};
+        if (LengthSq(p - corner) > Sqr(R)) {
+            Real const t = Collide_CornerParam(p - corner, m, R);
+            if (t > 0)
+                hit_corner(t, corner);
+            return ret;
+        }
+    }
+
+    // Already overlapping; this happens rarely enough to just try everything,
+    // in the old order (faces -x, +y, +x, -y, then the corners.)
+    Vec2f const face_normals [4] = {{-1.0f, 0}, {0, +1.0f}, {+1.0f, 0}, {0, -1.0f}};
+    for (int i = 0; i < 4; ++i) {
+        Vec2f const & n = face_normals[i];
+        bool const x_face = n.x != 0;
+        Real const mn = x_face ? m.x : m.y;
+        if (AlmostZero(mn * 2 * (x_face ? h.y : h.x)))
+            continue;
+        Real const t = (x_face ? n.x * e.x - p.x : n.y * e.y - p.y) / mn;
+        Vec2f const q = p + m * t;
+        bool const on_face = x_face ? Abs(q.y) <= h.y : Abs(q.x) <= h.x;
+        if (t > 0 && t <= 1.0f && on_face && (!ret.exists || t < ret.param))
+            hit(t, n);
+    }
+    Vec2f const corners [4] = {{-h.x, -h.y}, {-h.x, +h.y}, {+h.x, +h.y}, {+h.x, -h.y}};
+    for (auto const & corner : corners) {
+        Real const t = Collide_CornerParam(p - corner, m, R);
+        if (t > 0 && (!ret.exists || t < ret.param))
+            hit_corner(t, corner);
+    }
+    return ret;
+}
+
+//----------------------------------------------------------------------
+// One circle against a batch of static bricks, 4 or 8 at a time. Every
+// lane does exactly the floating-point operations Collide_CircleAAB()
+// does, in the same order, so every kernel (and the scalar one, which
+// just calls it) picks the same brick; a brick the circle already
+// overlaps goes through Collide_CircleAAB() itself. Only the winner's
+// point and normal are worked out, again by Collide_CircleAAB().
+
+struct BrickBatch {
+    float const * x;        // centers
+    float const * y;
+    float const * half_w;
+    float const * half_h;
+    int count;
+};
+
+struct BrickHit {
+    int index;              // into the batch; -1 if nothing's hit
+    CollisionResult collision;
+};
+
+// Returns the index of the brick hit first (lowest index on ties), or -1.
+using CollideBricksFunc = int (*) (Point2f const & circle_pos, Real circle_radius, Vec2f const & circle_movement, BrickBatch const & bricks);
+
+struct CollideKernel {
+    char const * name;
+    CollideBricksFunc func;
+};
+
+static inline Real
+Collide_BrickParam (Point2f const & circle_pos, Real circle_radius, Vec2f const & circle_movement, BrickBatch const & bricks, int i) {
+    CollisionResult const c = Collide_CircleAAB(
+        circle_pos, circle_radius, circle_movement,
+        {bricks.x[i], bricks.y[i]}, {bricks.half_w[i], bricks.half_h[i]}, {0.0f, 0.0f}
+    );
+    return c.exists ? c.param : 0;
+}
+
+static int
+Collide_Bricks_Scalar (Point2f const & circle_pos, Real circle_radius, Vec2f const & circle_movement, BrickBatch const & bricks) {
+    int best = -1;
+    Real best_t = 0;
+    for (int i = 0; i < bricks.count; ++i) {
+        Real const t = Collide_BrickParam(circle_pos, circle_radius, circle_movement, bricks, i);
+        if (t > 0 && (best < 0 || t < best_t)) {
+            best = i;
+            best_t = t;
+        }
+    }
+    return best;
+}
+
+// What's the same for every brick in the batch; the names follow
+// Collide_CircleAAB().
+struct CollideSweep {
+    Real px, py;            // circle center
+    Real r, rr;
+    Real mx, my;
+    bool move_x, move_y;
+    Real inv_x, inv_y;
+    Real mx2, my2;          // m.x * 2 and m.y * 2, for the face checks
+    bool corners;           // whether corner circles can be hit at all
+    Real mm, mm_rr;
+};
+
+static inline CollideSweep
+Collide_MakeSweep (Point2f const & circle_pos, Real circle_radius, Vec2f const & circle_movement) {
+    CollideSweep s = {};
+    Vec2f const m = circle_movement - Vec2f{0.0f, 0.0f};
+    s.px = circle_pos.x;
+    s.py = circle_pos.y;
+    s.r = circle_radius;
+    s.rr = Sqr(circle_radius);
+    s.mx = m.x;
+    s.my = m.y;
+    s.move_x = m.x != 0;
+    s.move_y = m.y != 0;
+    s.inv_x = s.move_x ? 1.0f / m.x : 0;
+    s.inv_y = s.move_y ? 1.0f / m.y : 0;
+    s.mx2 = m.x * 2;
+    s.my2 = m.y * 2;
+    s.mm = Dot(m, m);
+    s.corners = !AlmostZero(s.mm);
+    s.mm_rr = s.mm * Sqr(circle_radius);
+    return s;
+}
+
+// Keeps the earliest of the lanes' results; "t" is 0 for no hit, and lanes
+// in "fallback" get the scalar test instead.
+static inline void
+Collide_MergeLanes (
+    Point2f const & circle_pos, Real circle_radius, Vec2f const & circle_movement, BrickBatch const & bricks,
+    int first, int lanes, float const * t, unsigned fallback, int * best, Real * best_t
+) {
+    for (int l = 0; l < lanes; ++l) {
+        Real tl = t[l];
+        if (fallback & (1u << l))
+            tl = Collide_BrickParam(circle_pos, circle_radius, circle_movement, bricks, first + l);
+        if (tl > 0 && (*best < 0 || tl < *best_t)) {
+            *best = first + l;
+            *best_t = tl;
+        }
+    }
+}
+
+#if defined(BO_ARCH_X86)
+static BO_TARGET_SSE2 int
+Collide_Bricks_SSE2 (Point2f const & circle_pos, Real circle_radius, Vec2f const & circle_movement, BrickBatch const & bricks) {
+    CollideSweep const s = Collide_MakeSweep(circle_pos, circle_radius, circle_movement);
+    if (!s.move_x && !s.move_y)
+        return -1;
+
+    __m128 const sign = _mm_set1_ps(-0.0f), zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+    __m128 const eps = _mm_set1_ps(0.000001f);
+    __m128 const px = _mm_set1_ps(s.px), py = _mm_set1_ps(s.py), r = _mm_set1_ps(s.r), rr = _mm_set1_ps(s.rr);
+    __m128 const mx = _mm_set1_ps(s.mx), my = _mm_set1_ps(s.my);
+    __m128 const inv_x = _mm_set1_ps(s.inv_x), inv_y = _mm_set1_ps(s.inv_y);
+    __m128 const mx2 = _mm_set1_ps(s.mx2), my2 = _mm_set1_ps(s.my2);
+    __m128 const mm = _mm_set1_ps(s.mm), mm_rr = _mm_set1_ps(s.mm_rr);
+    #define BO_SEL(mask, a, b)  _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b))
+    #define BO_ABS(v)           _mm_andnot_ps(sign, v)
+
+    int best = -1;
+    Real best_t = 0;
+    int i = 0;
+    for (; i + 4 <= bricks.count; i += 4) {
+        __m128 const hx = _mm_loadu_ps(bricks.half_w + i), hy = _mm_loadu_ps(bricks.half_h + i);
+        __m128 const ex = _mm_add_ps(hx, r), ey = _mm_add_ps(hy, r);
+        __m128 const dx = _mm_sub_ps(px, _mm_loadu_ps(bricks.x + i));     // p, relative to the brick
+        __m128 const dy = _mm_sub_ps(py, _mm_loadu_ps(bricks.y + i));
+
+        // Slab test.
+        __m128 reject = _mm_setzero_ps();
+        __m128 t_enter, t_exit, axis_y;
+        __m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_xor_ps(ex, sign), dx), inv_x), t1x = _mm_mul_ps(_mm_sub_ps(ex, dx), inv_x);
+        __m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_xor_ps(ey, sign), dy), inv_y), t1y = _mm_mul_ps(_mm_sub_ps(ey, dy), inv_y);
+        if (s.inv_x < 0) {__m128 t = t0x; t0x = t1x; t1x = t;}
+        if (s.inv_y < 0) {__m128 t = t0y; t0y = t1y; t1y = t;}
+        if (s.move_x && s.move_y) {
+            axis_y = _mm_cmpgt_ps(t0y, t0x);
+            t_enter = BO_SEL(axis_y, t0y, t0x);
+            t_exit = _mm_min_ps(t1x, t1y);
+        } else if (s.move_x) {
+            reject = _mm_or_ps(_mm_cmplt_ps(dy, _mm_xor_ps(ey, sign)), _mm_cmpgt_ps(dy, ey));
+            axis_y = _mm_setzero_ps();
+            t_enter = t0x;
+            t_exit = t1x;
+        } else {
+            reject = _mm_or_ps(_mm_cmplt_ps(dx, _mm_xor_ps(ex, sign)), _mm_cmpgt_ps(dx, ex));
+            axis_y = _mm_cmpeq_ps(zero, zero);
+            t_enter = t0y;
+            t_exit = t1y;
+        }
+        reject = _mm_or_ps(reject, _mm_or_ps(_mm_cmpgt_ps(t_enter, t_exit),
+            _mm_or_ps(_mm_cmple_ps(t_exit, zero), _mm_cmpgt_ps(t_enter, one))));
+        if (0xF == _mm_movemask_ps(reject))
+            continue;
+
+        // Coming from outside: a face, or the corner region it went in at.
+        __m128 const outside = _mm_cmpgt_ps(t_enter, zero);
+        __m128 const qx = _mm_add_ps(dx, _mm_mul_ps(mx, t_enter)), qy = _mm_add_ps(dy, _mm_mul_ps(my, t_enter));
+        __m128 const face_x = _mm_andnot_ps(axis_y, _mm_and_ps(_mm_cmple_ps(BO_ABS(qy), hy),
+            _mm_cmpge_ps(BO_ABS(_mm_mul_ps(mx2, hy)), eps)));
+        __m128 const face_y = _mm_and_ps(axis_y, _mm_and_ps(_mm_cmple_ps(BO_ABS(qx), hx),
+            _mm_cmpge_ps(BO_ABS(_mm_mul_ps(my2, hx)), eps)));
+        __m128 const face = _mm_and_ps(outside, _mm_or_ps(face_x, face_y));
+
+        // Starting inside the box: fine if it's in a corner region but
+        // outside that circle; anything else is an overlap.
+        __m128 const in_corner_region = _mm_and_ps(_mm_cmpgt_ps(BO_ABS(dx), hx), _mm_cmpgt_ps(BO_ABS(dy), hy));
+        __m128 const from_x = BO_SEL(outside, qx, dx), from_y = BO_SEL(outside, qy, dy);
+        __m128 const cx = BO_SEL(_mm_cmplt_ps(from_x, zero), _mm_xor_ps(hx, sign), hx);
+        __m128 const cy = BO_SEL(_mm_cmplt_ps(from_y, zero), _mm_xor_ps(hy, sign), hy);
+        __m128 const ddx = _mm_sub_ps(dx, cx), ddy = _mm_sub_ps(dy, cy);
+        __m128 const dd = _mm_add_ps(_mm_mul_ps(ddx, ddx), _mm_mul_ps(ddy, ddy));
+        __m128 const clear_of_circle = _mm_and_ps(in_corner_region, _mm_cmpgt_ps(dd, rr));
+        __m128 const overlap = _mm_andnot_ps(_mm_or_ps(outside, clear_of_circle), _mm_andnot_ps(reject, _mm_cmpeq_ps(zero, zero)));
+        __m128 const corner = _mm_andnot_ps(face, _mm_or_ps(outside, clear_of_circle));
+
+        // The corner circle, as in Collide_CornerParam().
+        __m128 t_corner = zero;
+        if (s.corners) {
+            __m128 const dm = _mm_add_ps(_mm_mul_ps(ddx, mx), _mm_mul_ps(ddy, my));
+            __m128 const delta = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(dm, dm), _mm_mul_ps(mm, dd)), mm_rr);
+            __m128 const neg_dm = _mm_xor_ps(dm, sign);
+            __m128 const root = _mm_sqrt_ps(_mm_max_ps(delta, zero));
+            __m128 const t_lo = _mm_div_ps(_mm_sub_ps(neg_dm, root), mm);
+            __m128 const t_hi = _mm_div_ps(_mm_add_ps(neg_dm, root), mm);
+            __m128 const t_two = BO_SEL(_mm_cmple_ps(t_lo, zero), t_hi, t_lo);
+            __m128 const tangent = _mm_cmplt_ps(BO_ABS(delta), eps);
+            __m128 t = BO_SEL(tangent, _mm_div_ps(neg_dm, mm), _mm_and_ps(_mm_cmpgt_ps(delta, zero), t_two));
+            t_corner = _mm_and_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, zero), _mm_cmple_ps(t, one)));
+        }
+
+        __m128 t = BO_SEL(face, t_enter, _mm_and_ps(corner, t_corner));
+        t = _mm_andnot_ps(_mm_or_ps(reject, overlap), t);
+        alignas(16) float lanes [4];
+        _mm_store_ps(lanes, t);
+        Collide_MergeLanes(circle_pos, circle_radius, circle_movement, bricks, i, 4, lanes,
+            unsigned(_mm_movemask_ps(overlap)), &best, &best_t);
+    }
+    #undef BO_ABS
+    #undef BO_SEL
+
+    for (; i < bricks.count; ++i) {
+        Real const t = Collide_BrickParam(circle_pos, circle_radius, circle_movement, bricks, i);
+        if (t > 0 && (best < 0 || t < best_t)) {
+            best = i;
+            best_t = t;
+        }
+    }
+    return best;
+}
+
+// Same as the SSE2 one, 8 lanes wide.
+static BO_TARGET_AVX2 int
+Collide_Bricks_AVX2 (Point2f const & circle_pos, Real circle_radius, Vec2f const & circle_movement, BrickBatch const & bricks) {
+    CollideSweep const s = Collide_MakeSweep(circle_pos, circle_radius, circle_movement);
+    if (!s.move_x && !s.move_y)
+        return -1;
+
+    __m256 const sign = _mm256_set1_ps(-0.0f), zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+    __m256 const eps = _mm256_set1_ps(0.000001f);
+    __m256 const px = _mm256_set1_ps(s.px), py = _mm256_set1_ps(s.py), r = _mm256_set1_ps(s.r), rr = _mm256_set1_ps(s.rr);
+    __m256 const mx = _mm256_set1_ps(s.mx), my = _mm256_set1_ps(s.my);
+    __m256 const inv_x = _mm256_set1_ps(s.inv_x), inv_y = _mm256_set1_ps(s.inv_y);
+    __m256 const mx2 = _mm256_set1_ps(s.mx2), my2 = _mm256_set1_ps(s.my2);
+    __m256 const mm = _mm256_set1_ps(s.mm), mm_rr = _mm256_set1_ps(s.mm_rr);
+    #define BO_SEL(mask, a, b)  _mm256_blendv_ps(b, a, mask)
+    #define BO_CMP(op, a, b)    _mm256_cmp_ps(a, b, op)
+    #define BO_ABS(v)           _mm256_andnot_ps(sign, v)
+
+    int best = -1;
+    Real best_t = 0;
+    int i = 0;
+    for (; i + 8 <= bricks.count; i += 8) {
+        __m256 const hx = _mm256_loadu_ps(bricks.half_w + i), hy = _mm256_loadu_ps(bricks.half_h + i);
+        __m256 const ex = _mm256_add_ps(hx, r), ey = _mm256_add_ps(hy, r);
+        __m256 const dx = _mm256_sub_ps(px, _mm256_loadu_ps(bricks.x + i));     // p, relative to the brick
+        __m256 const dy = _mm256_sub_ps(py, _mm256_loadu_ps(bricks.y + i));
+
+        // Slab test.
+        __m256 reject = _mm256_setzero_ps();
+        __m256 t_enter, t_exit, axis_y;
+        __m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_xor_ps(ex, sign), dx), inv_x), t1x = _mm256_mul_ps(_mm256_sub_ps(ex, dx), inv_x);
+        __m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_xor_ps(ey, sign), dy), inv_y), t1y = _mm256_mul_ps(_mm256_sub_ps(ey, dy), inv_y);
+        if (s.inv_x < 0) {__m256 t = t0x; t0x = t1x; t1x = t;}
+        if (s.inv_y < 0) {__m256 t = t0y; t0y = t1y; t1y = t;}
+        if (s.move_x && s.move_y) {
+            axis_y = BO_CMP(_CMP_GT_OQ, t0y, t0x);
+            t_enter = BO_SEL(axis_y, t0y, t0x);
+            t_exit = _mm256_min_ps(t1x, t1y);
+        } else if (s.move_x) {
+            reject = _mm256_or_ps(BO_CMP(_CMP_LT_OQ, dy, _mm256_xor_ps(ey, sign)), BO_CMP(_CMP_GT_OQ, dy, ey));
+            axis_y = _mm256_setzero_ps();
+            t_enter = t0x;
+            t_exit = t1x;
+        } else {
+            reject = _mm256_or_ps(BO_CMP(_CMP_LT_OQ, dx, _mm256_xor_ps(ex, sign)), BO_CMP(_CMP_GT_OQ, dx, ex));
+            axis_y = BO_CMP(_CMP_EQ_OQ, zero, zero);
+            t_enter = t0y;
+            t_exit = t1y;
+        }
+        reject = _mm256_or_ps(reject, _mm256_or_ps(BO_CMP(_CMP_GT_OQ, t_enter, t_exit),
+            _mm256_or_ps(BO_CMP(_CMP_LE_OQ, t_exit, zero), BO_CMP(_CMP_GT_OQ, t_enter, one))));
+        if (0xFF == _mm256_movemask_ps(reject))
+            continue;
+
+        // Coming from outside: a face, or the corner region it went in at.
+        __m256 const outside = BO_CMP(_CMP_GT_OQ, t_enter, zero);
+        __m256 const qx = _mm256_add_ps(dx, _mm256_mul_ps(mx, t_enter)), qy = _mm256_add_ps(dy, _mm256_mul_ps(my, t_enter));
+        __m256 const face_x = _mm256_andnot_ps(axis_y, _mm256_and_ps(BO_CMP(_CMP_LE_OQ, BO_ABS(qy), hy),
+            BO_CMP(_CMP_GE_OQ, BO_ABS(_mm256_mul_ps(mx2, hy)), eps)));
+        __m256 const face_y = _mm256_and_ps(axis_y, _mm256_and_ps(BO_CMP(_CMP_LE_OQ, BO_ABS(qx), hx),
+            BO_CMP(_CMP_GE_OQ, BO_ABS(_mm256_mul_ps(my2, hx)), eps)));
+        __m256 const face = _mm256_and_ps(outside, _mm256_or_ps(face_x, face_y));
+
+        // Starting inside the box: fine if it's in a corner region but
+        // outside that circle; anything else is an overlap.
+        __m256 const in_corner_region = _mm256_and_ps(BO_CMP(_CMP_GT_OQ, BO_ABS(dx), hx), BO_CMP(_CMP_GT_OQ, BO_ABS(dy), hy));
+        __m256 const from_x = BO_SEL(outside, qx, dx), from_y = BO_SEL(outside, qy, dy);
+        __m256 const cx = BO_SEL(BO_CMP(_CMP_LT_OQ, from_x, zero), _mm256_xor_ps(hx, sign), hx);
+        __m256 const cy = BO_SEL(BO_CMP(_CMP_LT_OQ, from_y, zero), _mm256_xor_ps(hy, sign), hy);
+        __m256 const ddx = _mm256_sub_ps(dx, cx), ddy = _mm256_sub_ps(dy, cy);
+        __m256 const dd = _mm256_add_ps(_mm256_mul_ps(ddx, ddx), _mm256_mul_ps(ddy, ddy));
+        __m256 const clear_of_circle = _mm256_and_ps(in_corner_region, BO_CMP(_CMP_GT_OQ, dd, rr));
+        __m256 const overlap = _mm256_andnot_ps(_mm256_or_ps(outside, clear_of_circle), _mm256_andnot_ps(reject, BO_CMP(_CMP_EQ_OQ, zero, zero)));
+        __m256 const corner = _mm256_andnot_ps(face, _mm256_or_ps(outside, clear_of_circle));
+
+        // The corner circle, as in Collide_CornerParam().
+        __m256 t_corner = zero;
+        if (s.corners) {
+            __m256 const dm = _mm256_add_ps(_mm256_mul_ps(ddx, mx), _mm256_mul_ps(ddy, my));
+            __m256 const delta = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(dm, dm), _mm256_mul_ps(mm, dd)), mm_rr);
+            __m256 const neg_dm = _mm256_xor_ps(dm, sign);
+            __m256 const root = _mm256_sqrt_ps(_mm256_max_ps(delta, zero));
+            __m256 const t_lo = _mm256_div_ps(_mm256_sub_ps(neg_dm, root), mm);
+            __m256 const t_hi = _mm256_div_ps(_mm256_add_ps(neg_dm, root), mm);
+            __m256 const t_two = BO_SEL(BO_CMP(_CMP_LE_OQ, t_lo, zero), t_hi, t_lo);
+            __m256 const tangent = BO_CMP(_CMP_LT_OQ, BO_ABS(delta), eps);
+            __m256 t = BO_SEL(tangent, _mm256_div_ps(neg_dm, mm), _mm256_and_ps(BO_CMP(_CMP_GT_OQ, delta, zero), t_two));
+            t_corner = _mm256_and_ps(t, _mm256_and_ps(BO_CMP(_CMP_GT_OQ, t, zero), BO_CMP(_CMP_LE_OQ, t, one)));
+        }
+
+        __m256 t = BO_SEL(face, t_enter, _mm256_and_ps(corner, t_corner));
+        t = _mm256_andnot_ps(_mm256_or_ps(reject, overlap), t);
+        alignas(32) float lanes [8];
+        _mm256_store_ps(lanes, t);
+        Collide_MergeLanes(circle_pos, circle_radius, circle_movement, bricks, i, 8, lanes,
+            unsigned(_mm256_movemask_ps(overlap)), &best, &best_t);
+    }
+    #undef BO_CMP
+    #undef BO_ABS
+    #undef BO_SEL
+
+    for (; i < bricks.count; ++i) {
+        Real const t = Collide_BrickParam(circle_pos, circle_radius, circle_movement, bricks, i);
+        if (t > 0 && (best < 0 || t < best_t)) {
+            best = i;
+            best_t = t;
+        }
+    }
+    return best;
+}
+#endif
+
+static int
+Collide_AvailableKernels (CollideKernel * out, int max_count) {
+    int n = 0;
+    if (n < max_count) out[n++] = {"scalar", Collide_Bricks_Scalar};
+#if defined(BO_ARCH_X86)
+    if (n < max_count && Platform_HasSSE2()) out[n++] = {"sse2", Collide_Bricks_SSE2};
+    if (n < max_count && Platform_HasAVX2()) out[n++] = {"avx2", Collide_Bricks_AVX2};
+#endif
+    return n;
+}
+
+inline CollideKernel g_collide_kernel = {"scalar", Collide_Bricks_Scalar};
+
+// Picks the widest kernel the CPU supports.
+static inline void
+Collide_Init () {
+    CollideKernel kernels [8];
+    int const n = Collide_AvailableKernels(kernels, 8);
+    g_collide_kernel = kernels[n - 1];
+}
+
+static inline BrickHit
+Collide_CircleBricks (Point2f const & circle_pos, Real circle_radius, Vec2f const & circle_movement, BrickBatch const & bricks) {
+    BrickHit ret = {};
+    ret.index = g_collide_kernel.func(circle_pos, circle_radius, circle_movement, bricks);
+    if (ret.index >= 0) {
+        int const i = ret.index;
+        ret.collision = Collide_CircleAAB(
+            circle_pos, circle_radius, circle_movement,
+            {bricks.x[i], bricks.y[i]}, {bricks.half_w[i], bricks.half_h[i]}, {0.0f, 0.0f}
+        );
+    }
+    return ret;
+}
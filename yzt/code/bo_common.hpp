@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(NDEBUG)
+    #define ASSERT(cond, ...)   ((void)(cond))
+#else
+    #define ASSERT(cond, ...)   assert(cond)
+#endif
+using byte = unsigned char;
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define BO_ARCH_X86
+    #include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #define BO_ARCH_NEON
+    #include <arm_neon.h>
+#endif
+
+// MSVC lets any function use any intrinsic; GCC and Clang want to be told.
+#if defined(_MSC_VER)
+    #define BO_TARGET_SSE2
+    #define BO_TARGET_AVX2
+#else
+    #define BO_TARGET_SSE2      __attribute__((target("sse2")))
+    #define BO_TARGET_AVX2      __attribute__((target("avx2")))
+#endif
+
+inline void * Mem_AllocAligned (size_t size, size_t alignment) {
+#if defined(_MSC_VER)
+    return ::_aligned_malloc(size, alignment);
+#else
+    void * ret = nullptr;
+    return 0 == ::posix_memalign(&ret, alignment, size) ? ret : nullptr;
+#endif
+}
+
+inline void Mem_FreeAligned (void * ptr) {
+#if defined(_MSC_VER)
+    ::_aligned_free(ptr);
+#else
+    ::free(ptr);
+#endif
+}
@@ -0,0 +1,342 @@
+#pragma once
+
+#include "bo_common.hpp"
+#include "bo_render.hpp"
+#include <climits>
+#include <cstdio>
+
+// A frame's worth of Render_* calls, recorded instead of executed, so
+// they can be culled, merged and replayed into any canvas (or any part
+// of one) later, or written to disk and replayed somewhere else.
+//
+// Recording never allocates: the list has a fixed capacity, set with
+// DrawList_Init() or grown with DrawList_Reserve() between frames.
+//
+// Layers are canvases that somebody keeps up to date on their own (e.g.
+// the brick field, which hardly ever changes); a Layer command copies one
+// into the target as is. The list only refers to them, so a saved list
+// doesn't have their pixels, and they draw nothing after loading.
+
+enum class DrawOp : uint8_t {
+    Clear,
+    AAB,        // a, b, c, d = x0, y0, w, h
+    Circle,     // a, b, c    = x, y, r
+    Line,       // a, b, c, d = x0, y0, x1, y1
+    Span,       // a, b, c    = x0, x1, y
+    Layer,      // a, c, d    = layer index, width, height
+};
+
+struct DrawCmd {
+    Color color;
+    DrawOp op;
+    BlendMode blend;    // lines are always drawn opaque
+    byte pad_ [2];
+    int a, b, c, d;
+};
+static_assert(sizeof(DrawCmd) == 24, "DrawCmd is supposed to be compact.");
+
+struct DrawList {
+    static constexpr int MaxLayers = 4;
+
+    DrawCmd * cmds;
+    int count;
+    int capacity;
+    int dropped;        // pushes that didn't fit; should always be zero
+    Canvas const * layers [MaxLayers];
+};
+
+inline void DrawList_Init (DrawList * list, int capacity) {
+    list->cmds = (DrawCmd *)Mem_AllocAligned(sizeof(DrawCmd) * capacity, 64);
+    list->count = 0;
+    list->capacity = capacity;
+    list->dropped = 0;
+    for (auto & layer : list->layers)
+        layer = nullptr;
+}
+
+inline void DrawList_Free (DrawList * list) {
+    Mem_FreeAligned(list->cmds);
+    *list = {};
+}
+
+inline void DrawList_Reset (DrawList * list) {
+    list->count = 0;
+    list->dropped = 0;
+}
+
+// Makes room for at least "capacity" commands, keeping what's there.
+static inline void
+DrawList_Reserve (DrawList * list, int capacity) {
+    if (capacity > list->capacity) {
+        DrawList bigger;
+        DrawList_Init(&bigger, Max(capacity, 2 * list->capacity));
+        if (list->count > 0)
+            ::memcpy(bigger.cmds, list->cmds, sizeof(DrawCmd) * list->count);
+        bigger.count = list->count;
+        bigger.dropped = list->dropped;
+        ::memcpy(bigger.layers, list->layers, sizeof(list->layers));
+        DrawList_Free(list);
+        *list = bigger;
+    }
+}
+
+static inline void
+DrawList_Push (DrawList * list, DrawOp op, Color c, int a, int b, int cc, int d, BlendMode blend = BlendMode::Opaque) {
+    ASSERT(list->count < list->capacity, "Draw list is full; reserve more before recording.");
+    if (list->count < list->capacity) {
+        DrawCmd & cmd = list->cmds[list->count++];
+        cmd.color = c;
+        cmd.op = op;
+        cmd.blend = blend;
+        cmd.pad_[0] = cmd.pad_[1] = 0;
+        cmd.a = a; cmd.b = b; cmd.c = cc; cmd.d = d;
+    } else {
+        list->dropped += 1;
+    }
+}
+
+inline void DrawList_Clear (DrawList * list, Color c, BlendMode blend = BlendMode::Opaque) {DrawList_Push(list, DrawOp::Clear, c, 0, 0, 0, 0, blend);}
+inline void DrawList_AAB (DrawList * list, int x0, int y0, int w, int h, Color c, BlendMode blend = BlendMode::Opaque) {DrawList_Push(list, DrawOp::AAB, c, x0, y0, w, h, blend);}
+inline void DrawList_AAB (DrawList * list, Rect const & r, Color c, BlendMode blend = BlendMode::Opaque) {DrawList_AAB(list, r.x0, r.y0, r.x1 - r.x0, r.y1 - r.y0, c, blend);}
+inline void DrawList_Circle (DrawList * list, int x, int y, int r, Color c, BlendMode blend = BlendMode::Opaque) {DrawList_Push(list, DrawOp::Circle, c, x, y, r, 0, blend);}
+inline void DrawList_Line (DrawList * list, int x0, int y0, int x1, int y1, Color c) {DrawList_Push(list, DrawOp::Line, c, x0, y0, x1, y1);}
+inline void DrawList_Span (DrawList * list, int x0, int x1, int y, Color c, BlendMode blend = BlendMode::Opaque) {DrawList_Push(list, DrawOp::Span, c, x0, x1, y, 0, blend);}
+
+// The canvas has to stay alive (and the same size) for as long as the list
+// refers to it.
+inline void DrawList_SetLayer (DrawList * list, int index, Canvas const * layer) {
+    ASSERT(index >= 0 && index < DrawList::MaxLayers);
+    list->layers[index] = layer;
+}
+
+static inline void
+DrawList_Layer (DrawList * list, int index) {
+    ASSERT(index >= 0 && index < DrawList::MaxLayers && list->layers[index], "Set the layer before drawing it.");
+    Canvas const * layer = list->layers[index];
+    DrawList_Push(list, DrawOp::Layer, {0, 0, 0}, index, 0, layer ? layer->width : 0, layer ? layer->height : 0);
+}
+
+// Every pixel the command could possibly touch is inside this.
+static inline Rect
+DrawCmd_Bounds (DrawCmd const & cmd) {
+    switch (cmd.op) {
+    case DrawOp::Clear: return {INT_MIN, INT_MIN, INT_MAX, INT_MAX};
+    case DrawOp::AAB: return (cmd.c > 0 && cmd.d > 0) ? Rect_OfAAB(cmd.a, cmd.b, cmd.c, cmd.d) : Rect{};
+    case DrawOp::Circle: return cmd.c >= 0 ? Rect_OfCircle(cmd.a, cmd.b, cmd.c) : Rect{};
+    case DrawOp::Line: return {Min(cmd.a, cmd.c), Min(cmd.b, cmd.d), Max(cmd.a, cmd.c) + 1, Max(cmd.b, cmd.d) + 1};
+    case DrawOp::Span: return {Min(cmd.a, cmd.b), cmd.c, Max(cmd.a, cmd.b) + 1, cmd.c + 1};
+    case DrawOp::Layer: return {0, 0, cmd.c, cmd.d};
+    }
+    return {};
+}
+
+// The canvas a Layer command copies; null if it's not set (or the index
+// is bad), in which case the command draws nothing.
+static inline Canvas const *
+DrawList_LayerOf (DrawList const * list, DrawCmd const & cmd) {
+    return (cmd.a >= 0 && cmd.a < DrawList::MaxLayers) ? list->layers[cmd.a] : nullptr;
+}
+
+// Whether the command paints every pixel of "r" without looking at what
+// was there before.
+static inline bool
+DrawCmd_Covers (DrawList const * list, DrawCmd const & cmd, Rect const & r) {
+    switch (cmd.op) {
+    case DrawOp::Clear: return BlendMode::Opaque == cmd.blend;
+    case DrawOp::Layer: return DrawList_LayerOf(list, cmd) && Rect_Contains(DrawCmd_Bounds(cmd), r);
+    default: return false;
+    }
+}
+
+static inline void
+Render_Cmd (Canvas * canvas, DrawList const * list, DrawCmd const & cmd) {
+    switch (cmd.op) {
+    case DrawOp::Clear: Render_Clear(canvas, cmd.color, cmd.blend); break;
+    case DrawOp::AAB: Render_AAB(canvas, cmd.a, cmd.b, cmd.c, cmd.d, cmd.color, cmd.blend); break;
+    case DrawOp::Circle: Render_Circle(canvas, cmd.a, cmd.b, cmd.c, cmd.color, cmd.blend); break;
+    case DrawOp::Line: Render_Line(canvas, cmd.a, cmd.b, cmd.c, cmd.d, cmd.color); break;
+    case DrawOp::Span: Render_LineHoriz(canvas, cmd.a, cmd.b, cmd.c, cmd.color, cmd.blend); break;
+    case DrawOp::Layer:
+        if (Canvas const * layer = DrawList_LayerOf(list, cmd))
+            Render_Blit(canvas, layer, DrawCmd_Bounds(cmd));
+        break;
+    }
+}
+
+//----------------------------------------------------------------------
+// Rewrites the list in place into one that draws exactly the same pixels
+// inside "bounds" (usually the canvas), with less work:
+//  - anything before the last opaque Clear (or Layer covering all of
+//    "bounds") is dead, since it paints over it;
+//  - anything that doesn't touch "bounds" is dropped;
+//  - consecutive AABs with the same color and blend mode whose union is
+//    itself a rect are merged (blended ones only if they don't overlap,
+//    since the overlap would otherwise get blended once instead of twice.)
+// Order is otherwise kept; only neighbours in the list are ever merged,
+// since merging across another command could change what ends up on top.
+// Returns the number of commands removed.
+
+static inline int
+DrawList_Optimize (DrawList * list, Rect const & bounds) {
+    int first = 0;
+    for (int i = list->count - 1; i >= 0; --i)
+        if (DrawCmd_Covers(list, list->cmds[i], bounds)) {
+            first = i;
+            break;
+        }
+
+    int n = 0;
+    for (int i = first; i < list->count; ++i) {
+        DrawCmd const cmd = list->cmds[i];
+        if (!Rect_Overlaps(DrawCmd_Bounds(cmd), bounds))
+            continue;
+        if (DrawOp::AAB == cmd.op && n > 0) {
+            DrawCmd & prev = list->cmds[n - 1];
+            if (DrawOp::AAB == prev.op && prev.blend == cmd.blend && Color_Bits(prev.color) == Color_Bits(cmd.color)) {
+                Rect const p = DrawCmd_Bounds(prev), q = DrawCmd_Bounds(cmd);
+                bool const opaque = BlendMode::Opaque == cmd.blend;
+                bool const same_rows = p.y0 == q.y0 && p.y1 == q.y1
+                    && (opaque ? (p.x1 >= q.x0 && q.x1 >= p.x0) : (p.x1 == q.x0 || q.x1 == p.x0));
+                bool const same_cols = p.x0 == q.x0 && p.x1 == q.x1
+                    && (opaque ? (p.y1 >= q.y0 && q.y1 >= p.y0) : (p.y1 == q.y0 || q.y1 == p.y0));
+                if (same_rows || same_cols) {
+                    Rect const u = Rect_Union(p, q);
+                    prev.a = u.x0; prev.b = u.y0;
+                    prev.c = u.x1 - u.x0; prev.d = u.y1 - u.y0;
+                    continue;
+                }
+            }
+        }
+        list->cmds[n++] = cmd;
+    }
+
+    int const removed = list->count - n;
+    list->count = n;
+    return removed;
+}
+
+// Plays the whole list, in order, into whatever the canvas clip allows.
+static inline void
+DrawList_Execute (Canvas * canvas, DrawList const * list) {
+    PROFILE_SCOPE("DrawList_Execute");
+    for (int i = 0; i < list->count; ++i)
+        if (Rect_Overlaps(DrawCmd_Bounds(list->cmds[i]), canvas->clip))
+            Render_Cmd(canvas, list, list->cmds[i]);
+}
+
+//----------------------------------------------------------------------
+// On-disk format, all little-endian:
+//   "BODL", u32 version, i32 width, i32 height, i32 count,
+//   then "count" commands of: u8 op, u8 blend, u8 r, u8 g, u8 b, u8 a, i32 a, b, c, d
+
+static constexpr uint32_t DrawListFileVersion = 2;
+static constexpr int DrawListFileMaxSide = 1 << 14;     // of the canvas a loaded list is for
+static constexpr int DrawListFileMaxCoord = 1 << 29;    // what the line clipping in bo_render.hpp assumes
+
+// Whether a loaded command is one the renderer can take: coordinates
+// within +/-DrawListFileMaxCoord, and sizes no bigger and not negative.
+static inline bool
+DrawList_FileCmdIsValid (DrawCmd const & cmd) {
+    auto coord = [](int v){return v >= -DrawListFileMaxCoord && v <= DrawListFileMaxCoord;};
+    auto size = [](int v){return v >= 0 && v <= DrawListFileMaxCoord;};
+    switch (cmd.op) {
+    case DrawOp::Clear: return true;
+    case DrawOp::AAB: return coord(cmd.a) && coord(cmd.b) && size(cmd.c) && size(cmd.d);
+    case DrawOp::Circle: return coord(cmd.a) && coord(cmd.b) && size(cmd.c);
+    case DrawOp::Line: return coord(cmd.a) && coord(cmd.b) && coord(cmd.c) && coord(cmd.d);
+    case DrawOp::Span: return coord(cmd.a) && coord(cmd.b) && coord(cmd.c);
+    case DrawOp::Layer: return size(cmd.c) && size(cmd.d);
+    }
+    return false;
+}
+
+static inline void
+DrawList_PutU32 (FILE * f, uint32_t v) {
+    byte b [4] = {byte(v), byte(v >> 8), byte(v >> 16), byte(v >> 24)};
+    ::fwrite(b, 1, 4, f);
+}
+
+static inline bool
+DrawList_GetU32 (FILE * f, uint32_t * v) {
+    byte b [4];
+    if (4 != ::fread(b, 1, 4, f))
+        return false;
+    *v = uint32_t(b[0]) | (uint32_t(b[1]) << 8) | (uint32_t(b[2]) << 16) | (uint32_t(b[3]) << 24);
+    return true;
+}
+
+// "width" and "height" are the canvas the list was recorded for.
+static inline bool
+DrawList_Save (DrawList const * list, int width, int height, char const * path) {
+    FILE * f = ::fopen(path, "wb");
+    if (!f)
+        return false;
+    ::fwrite("BODL", 1, 4, f);
+    DrawList_PutU32(f, DrawListFileVersion);
+    DrawList_PutU32(f, uint32_t(width));
+    DrawList_PutU32(f, uint32_t(height));
+    DrawList_PutU32(f, uint32_t(list->count));
+    for (int i = 0; i < list->count; ++i) {
+        DrawCmd const & cmd = list->cmds[i];
+        byte head [6] = {byte(cmd.op), byte(cmd.blend), cmd.color.r, cmd.color.g, cmd.color.b, cmd.color.a};
+        ::fwrite(head, 1, 6, f);
+        DrawList_PutU32(f, uint32_t(cmd.a));
+        DrawList_PutU32(f, uint32_t(cmd.b));
+        DrawList_PutU32(f, uint32_t(cmd.c));
+        DrawList_PutU32(f, uint32_t(cmd.d));
+    }
+    bool const ok = !::ferror(f);
+    ::fclose(f);
+    return ok;
+}
+
+// Replaces the contents of "list" (growing it if needed.) The layers go
+// too; a saved list doesn't know what canvases they were, so its layer
+// commands draw nothing until somebody sets them again. A file with a
+// command out of range, or for a canvas bigger than DrawListFileMaxSide
+// a side, doesn't load.
+static inline bool
+DrawList_Load (DrawList * list, int * width, int * height, char const * path) {
+    FILE * f = ::fopen(path, "rb");
+    if (!f)
+        return false;
+    char magic [4] = {};
+    uint32_t version = 0, w = 0, h = 0, count = 0;
+    bool ok = 4 == ::fread(magic, 1, 4, f) && 0 == ::memcmp(magic, "BODL", 4)
+        && DrawList_GetU32(f, &version) && DrawListFileVersion == version
+        && DrawList_GetU32(f, &w) && DrawList_GetU32(f, &h)
+        && DrawList_GetU32(f, &count)
+        && w <= uint32_t(DrawListFileMaxSide) && h <= uint32_t(DrawListFileMaxSide);
+    size_t const head_size = 6;
+    if (ok) {
+        // However many commands the header says, no more than the rest
+        // of the file can hold get room made for them.
+        long const here = ::ftell(f);
+        ok = here >= 0 && 0 == ::fseek(f, 0, SEEK_END);
+        long const end = ok ? ::ftell(f) : -1;
+        ok = ok && end >= here && 0 == ::fseek(f, here, SEEK_SET)
+            && count <= uint64_t(end - here) / (head_size + 16);
+    }
+    if (ok) {
+        DrawList_Reset(list);
+        for (auto & layer : list->layers)
+            layer = nullptr;
+        DrawList_Reserve(list, int(count));
+        for (uint32_t i = 0; ok && i < count; ++i) {
+            byte head [6] = {};
+            uint32_t a, b, c, d;
+            ok = head_size == ::fread(head, 1, head_size, f)
+                && DrawList_GetU32(f, &a) && DrawList_GetU32(f, &b)
+                && DrawList_GetU32(f, &c) && DrawList_GetU32(f, &d);
+            ok = ok && head[0] <= byte(DrawOp::Layer) && head[1] <= byte(BlendMode::Multiply);
+            DrawCmd const cmd = {{head[2], head[3], head[4], head[5]}, DrawOp(head[0]), BlendMode(head[1]), {}, int(a), int(b), int(c), int(d)};
+            ok = ok && DrawList_FileCmdIsValid(cmd);
+            if (ok)
+                DrawList_Push(list, cmd.op, cmd.color, cmd.a, cmd.b, cmd.c, cmd.d, cmd.blend);
+        }
+        *width = int(w);
+        *height = int(h);
+    }
+    ::fclose(f);
+    return ok;
+}
@@ -0,0 +1,412 @@
+#pragma once
+
+#include "bo_common.hpp"
+#include "bo_math.hpp"
+#include "bo_collide.hpp"
+#include "bo_jobs.hpp"
+#include "bo_platform.hpp"
+#include "bo_sim.hpp"
+#include <vector>
+
+// Many games at once, stepped in lockstep, for training agents: the
+// classic one-ball game (no multi-ball), with a few lives per episode. All
+// the games' state is in arrays indexed by game, so a step is a few
+// passes over plain floats; the passes run four games at a time with
+// SSE2, and runs of games go to the job pool.
+//
+// Nearly every tick, nearly every ball is just flying (see
+// Sim_QuietTime()); those are moved in the vector pass, and only the rest
+// go through Sim_MoveBall(), one at a time, with the bricks of their own
+// game. A game's bricks are the bits of a mask, in the layout of
+// Sim_Init() (SimBrickRows * SimBrickCols of them), so a game is about a
+// hundred bytes and a reset is a handful of stores.
+//
+// A game steps exactly as Sim would with the same input and one ball.
+
+static_assert(SimBrickRows * SimBrickCols <= 64, "The bricks of a game have to fit a 64-bit mask.");
+
+enum EnvAction : byte {
+    EnvAction_Stay,
+    EnvAction_Left,
+    EnvAction_Right,
+    EnvAction_Serve,
+    EnvAction_Count
+};
+
+struct EnvConfig {
+    SimConfig sim;
+    int ticks_per_step = 16;        // the same action is held for this many ticks
+    int lives = 5;
+    uint32_t max_episode_ticks = 0; // 0 means no limit
+    int envs_per_job = 256;
+    int obs_width = 84, obs_height = 84;    // of each game's observation, in bytes
+};
+
+struct EnvBatch {
+    EnvConfig config;
+    int count;
+    JobPool * pool;                 // may be null; then it's all on the caller's thread
+
+    // One of each per game.
+    std::vector<float> paddle_x, paddle_prev_x, movement;
+    std::vector<float> ball_x, ball_y, dir_x, dir_y, quiet_s;
+    std::vector<byte> serving;      // the ball is on the paddle
+    std::vector<uint64_t> bricks;   // bit row * SimBrickCols + col is set while that brick is there
+    std::vector<int> lives;
+    std::vector<uint32_t> episode_ticks;
+
+    // What the last step did, per game. A game that's done has already
+    // been reset; its observation is the new episode's first.
+    std::vector<float> reward;      // bricks broken
+    std::vector<byte> done;
+
+    struct Job {
+        std::vector<int> slow;      // games the vector pass couldn't move
+        std::vector<int> slots;     // scratch for gathering bricks
+        std::vector<float> x, y, half_w, half_h;
+        double slow_ticks;          // in the last step
+    };
+    std::vector<Job> jobs;
+    bool use_sse2;
+
+    // The wall in observation pixels, worked out once: which row of bricks
+    // each row of pixels goes through (or -1), and what a row of pixels
+    // looks like for each set of bricks there can be in a row.
+    std::vector<int> obs_brick_row;
+    std::vector<byte> obs_row_patterns;     // (1 << SimBrickCols) * obs_width
+    float obs_scale_x, obs_scale_y;
+
+    uint64_t steps;
+    double ball_ticks, slow_ball_ticks;     // the ones the vector pass couldn't do
+};
+
+inline size_t EnvBatch_ObsSize (EnvBatch const * env) {return size_t(env->config.obs_width) * env->config.obs_height;}
+
+// Game "i" as it is at the start of an episode.
+static inline void
+EnvBatch_Reset (EnvBatch * env, int i) {
+    SimConfig const & c = env->config.sim;
+    env->paddle_x[i] = env->paddle_prev_x[i] = 0.5f * c.width;
+    env->movement[i] = 0.0f;
+    env->ball_x[i] = env->paddle_x[i];
+    env->ball_y[i] = c.paddle_vert_pos * c.height - c.paddle_half_dims.y - c.ball_radius;
+    env->dir_x[i] = env->dir_y[i] = 0.0f;
+    env->quiet_s[i] = 0.0f;
+    env->serving[i] = 1;
+    env->bricks[i] = (SimBrickRows * SimBrickCols < 64 ? (1ULL << (SimBrickRows * SimBrickCols)) - 1 : ~0ULL);
+    env->lives[i] = env->config.lives;
+    env->episode_ticks[i] = 0;
+}
+
+static inline void
+EnvBatch_Init (EnvBatch * env, EnvConfig const & config, int count, JobPool * pool) {
+    env->config = config;
+    env->count = count;
+    env->pool = pool;
+    for (auto * v : {&env->paddle_x, &env->paddle_prev_x, &env->movement, &env->ball_x, &env->ball_y, &env->dir_x, &env->dir_y, &env->quiet_s, &env->reward})
+        v->assign(count, 0.0f);
+    env->serving.assign(count, 0);
+    env->bricks.assign(count, 0);
+    env->lives.assign(count, 0);
+    env->episode_ticks.assign(count, 0);
+    env->done.assign(count, 0);
+    for (int i = 0; i < count; ++i)
+        EnvBatch_Reset(env, i);
+
+    int const job_count = (count + config.envs_per_job - 1) / config.envs_per_job;
+    env->jobs.assign(job_count, {});
+#if defined(BO_ARCH_X86)
+    env->use_sse2 = Platform_HasSSE2();
+#else
+    env->use_sse2 = false;
+#endif
+
+    SimConfig const & c = config.sim;
+    env->obs_scale_x = float(config.obs_width) / c.width;
+    env->obs_scale_y = float(config.obs_height) / c.height;
+    int const w = config.obs_width, h = config.obs_height;
+    auto to_pixel = [](float v, float scale, int size){return Min(Max(int(v * scale + 0.5f), 0), size);};
+    env->obs_brick_row.assign(h, -1);
+    for (int r = 0; r < SimBrickRows; ++r) {
+        float const y = Sim_BrickCenter(c, r, 0).y;
+        for (int py = to_pixel(y - c.brick_half_dims.y, env->obs_scale_y, h); py < to_pixel(y + c.brick_half_dims.y, env->obs_scale_y, h); ++py)
+            env->obs_brick_row[py] = r;
+    }
+    env->obs_row_patterns.assign(size_t(w) << SimBrickCols, 0);
+    for (int cols = 0; cols < (1 << SimBrickCols) && w > 0; ++cols)
+        for (int k = 0; k < SimBrickCols; ++k)
+            if (cols >> k & 1) {
+                float const x = Sim_BrickCenter(c, 0, k).x;
+                int const x0 = to_pixel(x - c.brick_half_dims.x, env->obs_scale_x, w);
+                int const x1 = to_pixel(x + c.brick_half_dims.x, env->obs_scale_x, w);
+                ::memset(&env->obs_row_patterns[size_t(cols) * w + x0], 128, Max(x1 - x0, 0));
+            }
+    env->steps = 0;
+    env->slow_ball_ticks = env->ball_ticks = 0;
+}
+
+//----------------------------------------------------------------------
+
+// The part of a tick that's the same for every game in [begin, end): the
+// paddle moves, and a ball that can't hit anything this tick flies on.
+// Games it doesn't finish with (a ball on the paddle, or one that might
+// hit something) are added to "slow".
+static inline void
+EnvBatch_Advance_Scalar (EnvBatch * env, int begin, int end, std::vector<int> * slow) {
+    SimConfig const & c = env->config.sim;
+    float const dt = 1.0f / c.tick_hz;
+    float const paddle_lo = c.paddle_half_dims.x, paddle_hi = c.width - c.paddle_half_dims.x;
+    for (int i = begin; i < end; ++i) {
+        float x = env->paddle_x[i];
+        env->paddle_prev_x[i] = x;
+        x += env->movement[i] * c.paddle_speed * dt;
+        x = Min(Max(x, paddle_lo), paddle_hi);
+        env->paddle_x[i] = x;
+        if (!env->serving[i] && env->quiet_s[i] >= dt) {
+            env->ball_x[i] += env->dir_x[i] * (c.ball_speed * dt);
+            env->ball_y[i] += env->dir_y[i] * (c.ball_speed * dt);
+            env->quiet_s[i] -= dt;
+        } else {
+            slow->push_back(i);
+        }
+    }
+}
+
+#if defined(BO_ARCH_X86)
+static BO_TARGET_SSE2 void
+EnvBatch_Advance_SSE2 (EnvBatch * env, int begin, int end, std::vector<int> * slow) {
+    SimConfig const & c = env->config.sim;
+    float const dt = 1.0f / c.tick_hz;
+    __m128 const paddle_lo = _mm_set1_ps(c.paddle_half_dims.x), paddle_hi = _mm_set1_ps(c.width - c.paddle_half_dims.x);
+    __m128 const paddle_speed = _mm_set1_ps(c.paddle_speed), dt4 = _mm_set1_ps(dt);
+    __m128 const step = _mm_set1_ps(c.ball_speed * dt);
+    int i = begin;
+    for (; i + 4 <= end; i += 4) {
+        __m128 x = _mm_loadu_ps(&env->paddle_x[i]);
+        _mm_storeu_ps(&env->paddle_prev_x[i], x);
+        // Same order of operations as the scalar version, so the same bits.
+        x = _mm_add_ps(x, _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(&env->movement[i]), paddle_speed), dt4));
+        x = _mm_min_ps(_mm_max_ps(x, paddle_lo), paddle_hi);
+        _mm_storeu_ps(&env->paddle_x[i], x);
+
+        int serving;
+        ::memcpy(&serving, &env->serving[i], 4);
+        __m128 const flying = _mm_castsi128_ps(_mm_cmpeq_epi32(
+            _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(serving), _mm_setzero_si128()), _mm_setzero_si128()),
+            _mm_setzero_si128()
+        ));
+        __m128 const quiet = _mm_loadu_ps(&env->quiet_s[i]);
+        __m128 const fast = _mm_and_ps(flying, _mm_cmpge_ps(quiet, dt4));
+        __m128 const bx = _mm_add_ps(_mm_loadu_ps(&env->ball_x[i]), _mm_and_ps(fast, _mm_mul_ps(_mm_loadu_ps(&env->dir_x[i]), step)));
+        __m128 const by = _mm_add_ps(_mm_loadu_ps(&env->ball_y[i]), _mm_and_ps(fast, _mm_mul_ps(_mm_loadu_ps(&env->dir_y[i]), step)));
+        _mm_storeu_ps(&env->ball_x[i], bx);
+        _mm_storeu_ps(&env->ball_y[i], by);
+        _mm_storeu_ps(&env->quiet_s[i], _mm_sub_ps(quiet, _mm_and_ps(fast, dt4)));
+
+        int const slow_mask = ~_mm_movemask_ps(fast) & 0xF;
+        for (int k = 0; k < 4; ++k)
+            if (slow_mask & (1 << k))
+                slow->push_back(i + k);
+    }
+    EnvBatch_Advance_Scalar(env, i, end, slow);
+}
+#endif
+
+// Puts the bricks of game "i" that are in [lo, hi] into the job's scratch
+// arrays, in slot order.
+static inline BrickBatch
+EnvBatch_GatherBricks (EnvBatch const * env, int i, Point2f const & lo, Point2f const & hi, EnvBatch::Job * job) {
+    SimConfig const & c = env->config.sim;
+    job->slots.clear();
+    job->x.clear();
+    job->y.clear();
+    job->half_w.clear();
+    job->half_h.clear();
+    uint64_t const bits = env->bricks[i];
+    for (int slot = 0; slot < SimBrickRows * SimBrickCols; ++slot) {
+        if (!(bits >> slot & 1))
+            continue;
+        Point2f const center = Sim_BrickCenter(c, slot / SimBrickCols, slot % SimBrickCols);
+        if (center.x + c.brick_half_dims.x < lo.x || center.x - c.brick_half_dims.x > hi.x ||
+            center.y + c.brick_half_dims.y < lo.y || center.y - c.brick_half_dims.y > hi.y)
+            continue;
+        job->slots.push_back(slot);
+        job->x.push_back(center.x);
+        job->y.push_back(center.y);
+        job->half_w.push_back(c.brick_half_dims.x);
+        job->half_h.push_back(c.brick_half_dims.y);
+    }
+    return {job->x.data(), job->y.data(), job->half_w.data(), job->half_h.data(), int(job->slots.size())};
+}
+
+// The rest of a tick for game "i", which the vector pass left alone.
+// Returns whether the ball was lost.
+static inline bool
+EnvBatch_TickSlow (EnvBatch * env, int i, EnvBatch::Job * job) {
+    SimConfig const & c = env->config.sim;
+    float const dt = 1.0f / c.tick_hz;
+    float const paddle_y = c.paddle_vert_pos * c.height;
+    if (env->serving[i]) {
+        env->ball_x[i] = env->paddle_x[i];
+        env->ball_y[i] = paddle_y - c.paddle_half_dims.y - c.ball_radius;
+        env->dir_x[i] = env->dir_y[i] = 0.0f;
+        env->quiet_s[i] = 0.0f;
+        return false;
+    }
+
+    auto gather = [&](Point2f const & lo, Point2f const & hi){
+        return EnvBatch_GatherBricks(env, i, lo, hi, job);
+    };
+    auto hit = [&](int k){
+        env->bricks[i] &= ~(1ULL << job->slots[k]);
+        env->reward[i] += 1.0f;
+    };
+    Point2f const paddle_pos = {env->paddle_prev_x[i], paddle_y};
+    Vec2f const paddle_movement = {env->paddle_x[i] - env->paddle_prev_x[i], 0.0f};
+    Point2f bp = {env->ball_x[i], env->ball_y[i]};
+    Vec2f bd = {env->dir_x[i], env->dir_y[i]};
+    SimMove const move = Sim_MoveBall(c, dt, paddle_pos, paddle_movement, &bp, &bd, gather, hit, nullptr);
+    env->ball_x[i] = bp.x;
+    env->ball_y[i] = bp.y;
+    env->dir_x[i] = bd.x;
+    env->dir_y[i] = bd.y;
+    env->quiet_s[i] = 0.0f;
+    if (SimMove::Done == move)
+        env->quiet_s[i] = Sim_QuietTime(c, paddle_pos + paddle_movement, bp, bd, gather);
+    return SimMove::Lost == move;
+}
+
+//----------------------------------------------------------------------
+
+// Game "i"'s observation: one byte per pixel, the field scaled down to
+// obs_width * obs_height; bricks are 128, the paddle and the ball 255.
+static inline void
+EnvBatch_RenderOne (EnvBatch const * env, int i, byte * out) {
+    EnvConfig const & config = env->config;
+    SimConfig const & c = config.sim;
+    int const w = config.obs_width, h = config.obs_height;
+    auto fill = [&](int x0, int y0, int x1, int y1, byte value){
+        x0 = Max(x0, 0); y0 = Max(y0, 0);
+        x1 = Min(x1, w); y1 = Min(y1, h);
+        for (int y = y0; y < y1; ++y)
+            ::memset(out + size_t(y) * w + x0, value, Max(x1 - x0, 0));
+    };
+    auto fill_box = [&](float cx, float cy, float hw, float hh, byte value){
+        // At least a pixel, however small the scale.
+        int const x0 = int((cx - hw) * env->obs_scale_x), y0 = int((cy - hh) * env->obs_scale_y);
+        fill(x0, y0, Max(x0 + 1, int((cx + hw) * env->obs_scale_x + 0.5f)), Max(y0 + 1, int((cy + hh) * env->obs_scale_y + 0.5f)), value);
+    };
+
+    // The wall goes in a row of pixels at a time; that's all the clearing
+    // there is, too.
+    uint64_t const bits = env->bricks[i];
+    for (int y = 0; y < h; ++y) {
+        int const r = env->obs_brick_row[y];
+        if (r < 0)
+            ::memset(out + size_t(y) * w, 0, w);
+        else
+            ::memcpy(out + size_t(y) * w, &env->obs_row_patterns[size_t(bits >> (r * SimBrickCols) & ((1 << SimBrickCols) - 1)) * w], w);
+    }
+    fill_box(env->paddle_x[i], c.paddle_vert_pos * c.height, c.paddle_half_dims.x, c.paddle_half_dims.y, 255);
+    fill_box(env->ball_x[i], env->ball_y[i], c.ball_radius, c.ball_radius, 255);
+}
+
+// Every game's observation, one after the other (N * height * width.)
+static inline void
+EnvBatch_Render (EnvBatch * env, byte * obs) {
+    int const job_count = int(env->jobs.size());
+    auto render = [&](int j){
+        int const end = Min(env->count, (j + 1) * env->config.envs_per_job);
+        for (int i = j * env->config.envs_per_job; i < end; ++i)
+            EnvBatch_RenderOne(env, i, obs + i * EnvBatch_ObsSize(env));
+    };
+    if (env->pool)
+        JobPool_ForEach(env->pool, job_count, render);
+    else
+        for (int j = 0; j < job_count; ++j)
+            render(j);
+}
+
+// One step of every game: "actions" has an EnvAction for each, which is
+// held for ticks_per_step ticks. Fills in reward and done, resets the games
+// that are done, and, if "obs" isn't null, renders every game into it (as
+// EnvBatch_Render() does) while it's at it.
+static inline void
+EnvBatch_Step (EnvBatch * env, byte const * actions, byte * obs) {
+    EnvConfig const & config = env->config;
+    int const job_count = int(env->jobs.size());
+    auto step = [&](int j){
+        EnvBatch::Job & job = env->jobs[j];
+        int const begin = j * config.envs_per_job;
+        int const end = Min(env->count, begin + config.envs_per_job);
+        for (int i = begin; i < end; ++i) {
+            ASSERT(actions[i] < EnvAction_Count);
+            env->movement[i] = (EnvAction_Left == actions[i] ? -1.0f : EnvAction_Right == actions[i] ? 1.0f : 0.0f);
+            env->reward[i] = 0.0f;
+            env->done[i] = 0;
+            if (EnvAction_Serve == actions[i] && env->serving[i]) {
+                // As Sim_Act() serves a ball with no movement held.
+                env->serving[i] = 0;
+                Vec2f const dir = Normalize({1.0f, -1.0f});
+                env->dir_x[i] = dir.x;
+                env->dir_y[i] = dir.y;
+                env->quiet_s[i] = 0.0f;
+            }
+        }
+        double slow_ticks = 0;
+        for (int t = 0; t < config.ticks_per_step; ++t) {
+            job.slow.clear();
+#if defined(BO_ARCH_X86)
+            if (env->use_sse2)
+                EnvBatch_Advance_SSE2(env, begin, end, &job.slow);
+            else
+#endif
+                EnvBatch_Advance_Scalar(env, begin, end, &job.slow);
+            slow_ticks += double(job.slow.size());
+            for (int i : job.slow)
+                if (EnvBatch_TickSlow(env, i, &job)) {
+                    // Back on the paddle, from the next tick on.
+                    env->serving[i] = 1;
+                    env->lives[i] -= 1;
+                }
+        }
+        for (int i = begin; i < end; ++i) {
+            env->episode_ticks[i] += config.ticks_per_step;
+            if (env->lives[i] <= 0 || 0 == env->bricks[i] ||
+                (config.max_episode_ticks > 0 && env->episode_ticks[i] >= config.max_episode_ticks)) {
+                env->done[i] = 1;
+                EnvBatch_Reset(env, i);
+            }
+            if (obs)
+                EnvBatch_RenderOne(env, i, obs + i * EnvBatch_ObsSize(env));
+        }
+        job.slow_ticks = slow_ticks;
+    };
+    if (env->pool)
+        JobPool_ForEach(env->pool, job_count, step);
+    else
+        for (int j = 0; j < job_count; ++j)
+            step(j);
+
+    env->steps += 1;
+    env->ball_ticks += double(env->count) * config.ticks_per_step;
+    for (EnvBatch::Job const & job : env->jobs)
+        env->slow_ball_ticks += job.slow_ticks;
+}
+
+// An action for every game, as Sim_Autopilot() would play it; something
+// to run the batch with when there's no agent.
+static inline void
+EnvBatch_Autopilot (EnvBatch const * env, byte * actions) {
+    float const slack = 0.25f * env->config.sim.paddle_half_dims.x;
+    for (int i = 0; i < env->count; ++i) {
+        if (env->serving[i])
+            actions[i] = EnvAction_Serve;
+        else if (env->ball_x[i] < env->paddle_x[i] - slack)
+            actions[i] = EnvAction_Left;
+        else if (env->ball_x[i] > env->paddle_x[i] + slack)
+            actions[i] = EnvAction_Right;
+        else
+            actions[i] = EnvAction_Stay;
+    }
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "bo_common.hpp"
+#include "bo_math.hpp"
+#include <algorithm>
+#include <vector>
+
+// A uniform grid over axis-aligned boxes (the bricks), so that a moving
+// ball only has to look at the few boxes near its path. Every box is
+// listed in each cell it overlaps, and remembers where, so taking one out
+// is a handful of swaps however many boxes there are.
+//
+// Cells are at least as big as any box, so a box is in at most 4 of them.
+// Boxes (and queries) sticking out of the grid go into the border cells.
+
+struct SpatialGrid {
+    static constexpr int MaxCellsPerItem = 4;
+
+    struct Ref {int cell, slot;};
+    struct Item {
+        int ref_count;      // 0 if the id isn't in the grid
+        Ref refs [MaxCellsPerItem];
+    };
+
+    Point2f origin;
+    Vec2f inv_cell_dims;
+    int cols, rows;
+    std::vector<std::vector<int>> cells;    // item ids
+    std::vector<Item> items;                // indexed by id
+    std::vector<unsigned> stamps;           // so a query reports an item only once
+    unsigned stamp;
+};
+
+// Covers [origin, origin + dims); "cell_dims" shouldn't be smaller than
+// the biggest box that's going to be inserted.
+static inline void
+SpatialGrid_Init (SpatialGrid * grid, Point2f const & origin, Vec2f const & dims, Vec2f const & cell_dims) {
+    grid->origin = origin;
+    grid->inv_cell_dims = {1.0f / cell_dims.x, 1.0f / cell_dims.y};
+    grid->cols = Max(1, int(ceilf(dims.x / cell_dims.x)));
+    grid->rows = Max(1, int(ceilf(dims.y / cell_dims.y)));
+    grid->cells.assign(size_t(grid->cols) * grid->rows, {});
+    grid->items.clear();
+    grid->stamps.clear();
+    grid->stamp = 0;
+}
+
+// The range of cells, inclusive, that [lo, hi] touches.
+static inline void
+SpatialGrid_CellRange (SpatialGrid const * grid, Point2f const & lo, Point2f const & hi, int * c0, int * r0, int * c1, int * r1) {
+    Vec2f const a = (lo - grid->origin) * grid->inv_cell_dims;
+    Vec2f const b = (hi - grid->origin) * grid->inv_cell_dims;
+    *c0 = Min(Max(int(floorf(a.x)), 0), grid->cols - 1);
+    *r0 = Min(Max(int(floorf(a.y)), 0), grid->rows - 1);
+    *c1 = Min(Max(int(floorf(b.x)), 0), grid->cols - 1);
+    *r1 = Min(Max(int(floorf(b.y)), 0), grid->rows - 1);
+}
+
+static inline void
+SpatialGrid_Insert (SpatialGrid * grid, int id, Point2f const & lo, Point2f const & hi) {
+    ASSERT(id >= 0);
+    if (size_t(id) >= grid->items.size()) {
+        grid->items.resize(size_t(id) + 1, SpatialGrid::Item{});
+        grid->stamps.resize(size_t(id) + 1, 0);
+    }
+    SpatialGrid::Item & item = grid->items[id];
+    ASSERT(0 == item.ref_count, "Already in the grid.");
+
+    int c0, r0, c1, r1;
+    SpatialGrid_CellRange(grid, lo, hi, &c0, &r0, &c1, &r1);
+    ASSERT((c1 - c0 + 1) * (r1 - r0 + 1) <= SpatialGrid::MaxCellsPerItem, "Cells are too small for this box.");
+    item.ref_count = 0;
+    for (int r = r0; r <= r1; ++r)
+        for (int c = c0; c <= c1 && item.ref_count < SpatialGrid::MaxCellsPerItem; ++c) {
+            int const cell = r * grid->cols + c;
+            item.refs[item.ref_count++] = {cell, int(grid->cells[cell].size())};
+            grid->cells[cell].push_back(id);
+        }
+}
+
+static inline void
+SpatialGrid_Remove (SpatialGrid * grid, int id) {
+    ASSERT(id >= 0 && size_t(id) < grid->items.size());
+    SpatialGrid::Item & item = grid->items[id];
+    for (int i = 0; i < item.ref_count; ++i) {
+        SpatialGrid::Ref const ref = item.refs[i];
+        auto & cell = grid->cells[ref.cell];
+        int const moved = cell.back();
+        cell[ref.slot] = moved;
+        cell.pop_back();
+        if (moved != id) {
+            // The one that took our slot has to know where it went.
+            SpatialGrid::Item & m = grid->items[moved];
+            for (int j = 0; j < m.ref_count; ++j)
+                if (m.refs[j].cell == ref.cell)
+                    m.refs[j].slot = ref.slot;
+        }
+    }
+    item.ref_count = 0;
+}
+
+// Calls f(id) once for every item whose cells overlap [lo, hi]; the
+// caller still has to do the actual test.
+template <typename F>
+static inline void
+SpatialGrid_Query (SpatialGrid * grid, Point2f const & lo, Point2f const & hi, F && f) {
+    if (0 == ++grid->stamp) {   // wrapped around; start over
+        std::fill(grid->stamps.begin(), grid->stamps.end(), 0u);
+        grid->stamp = 1;
+    }
+    int c0, r0, c1, r1;
+    SpatialGrid_CellRange(grid, lo, hi, &c0, &r0, &c1, &r1);
+    for (int r = r0; r <= r1; ++r)
+        for (int c = c0; c <= c1; ++c)
+            for (int id : grid->cells[r * grid->cols + c])
+                if (grid->stamps[id] != grid->stamp) {
+                    grid->stamps[id] = grid->stamp;
+                    f(id);
+                }
+}
+
+// The same items as SpatialGrid_Query(), as a sorted list with no
+// duplicates, without touching the grid; so any number of threads can
+// ask at once.
+static inline void
+SpatialGrid_Collect (SpatialGrid const * grid, Point2f const & lo, Point2f const & hi, std::vector<int> * out) {
+    out->clear();
+    int c0, r0, c1, r1;
+    SpatialGrid_CellRange(grid, lo, hi, &c0, &r0, &c1, &r1);
+    for (int r = r0; r <= r1; ++r)
+        for (int c = c0; c <= c1; ++c) {
+            auto const & cell = grid->cells[r * grid->cols + c];
+            out->insert(out->end(), cell.begin(), cell.end());
+        }
+    std::sort(out->begin(), out->end());
+    out->erase(std::unique(out->begin(), out->end()), out->end());
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "bo_common.hpp"
+#include <algorithm>
+
+// The player's paddle input as a function of time, rather than of frames.
+// Key presses and releases go in with when they happened, and each tick
+// takes the movement averaged over exactly the stretch of time it stands
+// for; a key that went down half way through a tick moves the paddle for
+// half of it. So it doesn't matter when in the frame an event gets read,
+// as long as it's read before the ticks that cover it run.
+//
+// It also keeps track of the earliest change that went into a tick, for
+// measuring how long it takes an input to get onto the screen.
+
+struct InputTimeline {
+    static constexpr int Capacity = 256;
+
+    struct Change {
+        double time_s;
+        float movement;         // from then on
+    };
+
+    Change changes [Capacity];  // in time order; the ones no tick has got to yet
+    int count;
+    float movement;             // before the first of those
+    float latest;               // after the last of those
+    bool left, right;           // the keys, as of the latest event
+    double used_s;              // how far the ticks have got
+    double first_used_s;        // the earliest change used since InputTimeline_TakeFirstUsed(); 0 if none
+};
+
+static inline void
+InputTimeline_Init (InputTimeline * tl, double now_s) {
+    *tl = {};
+    tl->used_s = now_s;
+}
+
+// The keys, as of "time_s". An event that turns up after the ticks have
+// moved past its time counts from where they are now.
+static inline void
+InputTimeline_Keys (InputTimeline * tl, double time_s, bool left, bool right) {
+    tl->left = left;
+    tl->right = right;
+    float const m = float(int(right) - int(left));
+    if (m == tl->latest)
+        return;
+    time_s = std::max(time_s, tl->used_s);
+    if (tl->count > 0)
+        time_s = std::max(time_s, tl->changes[tl->count - 1].time_s);
+    if (tl->count == InputTimeline::Capacity) {
+        // Nobody's ticking; the oldest change just happens sooner.
+        tl->movement = tl->changes[0].movement;
+        std::copy(tl->changes + 1, tl->changes + tl->count, tl->changes);
+        tl->count -= 1;
+    }
+    tl->changes[tl->count++] = {time_s, m};
+    tl->latest = m;
+}
+
+// The average movement over [t0, t1], which is where the next tick is;
+// the changes before t1 are used up.
+static inline float
+InputTimeline_Take (InputTimeline * tl, double t0, double t1) {
+    tl->used_s = t1;
+    if (0 == tl->count || tl->changes[0].time_s >= t1)
+        return tl->movement;
+
+    float m = tl->movement;
+    double t = t0, sum = 0.0;
+    int used = 0;
+    for (; used < tl->count && tl->changes[used].time_s < t1; ++used) {
+        InputTimeline::Change const & c = tl->changes[used];
+        double const ct = std::max(c.time_s, t0);
+        sum += m * (ct - t);
+        t = ct;
+        m = c.movement;
+        if (0 == tl->first_used_s)
+            tl->first_used_s = c.time_s;
+    }
+    sum += m * (t1 - t);
+    std::copy(tl->changes + used, tl->changes + tl->count, tl->changes);
+    tl->count -= used;
+    tl->movement = m;
+    return float(sum / (t1 - t0));
+}
+
+// When the earliest of the changes the ticks have used since the last
+// call happened; 0 if there weren't any.
+static inline double
+InputTimeline_TakeFirstUsed (InputTimeline * tl) {
+    double const ret = tl->first_used_s;
+    tl->first_used_s = 0;
+    return ret;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "bo_common.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads that run "parallel for" batches. The
+// calling thread works on the batch too, and JobPool_Run() only returns
+// once every index has been processed, so there's never anything in
+// flight between batches.
+
+using JobFunc = void (*) (void * user, int index);
+
+struct JobPool {
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+
+    JobFunc func;
+    void * user;
+    int job_count;
+    std::atomic<int> next_job;
+    int busy_workers;
+    unsigned generation;
+    bool quit;
+};
+
+static inline void
+JobPool_Work (JobPool * pool) {
+    for (;;) {
+        int i = pool->next_job.fetch_add(1, std::memory_order_relaxed);
+        if (i >= pool->job_count)
+            break;
+        pool->func(pool->user, i);
+    }
+}
+
+static inline void
+JobPool_WorkerMain (JobPool * pool) {
+    unsigned seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock (pool->mutex);
+            pool->wake.wait(lock, [&]{return pool->quit || pool->generation != seen;});
+            if (pool->quit)
+                return;
+            seen = pool->generation;
+        }
+        JobPool_Work(pool);
+        {
+            std::lock_guard<std::mutex> lock (pool->mutex);
+            if (--pool->busy_workers == 0)
+                pool->done.notify_one();
+        }
+    }
+}
+
+// "thread_count" includes the caller, so 1 (or less) means no workers at all.
+static inline void
+JobPool_Start (JobPool * pool, int thread_count) {
+    pool->func = nullptr;
+    pool->user = nullptr;
+    pool->job_count = 0;
+    pool->next_job = 0;
+    pool->busy_workers = 0;
+    pool->generation = 0;
+    pool->quit = false;
+    for (int i = 1; i < thread_count; ++i)
+        pool->threads.emplace_back(JobPool_WorkerMain, pool);
+}
+
+static inline void
+JobPool_Stop (JobPool * pool) {
+    {
+        std::lock_guard<std::mutex> lock (pool->mutex);
+        pool->quit = true;
+    }
+    pool->wake.notify_all();
+    for (auto & t : pool->threads)
+        t.join();
+    pool->threads.clear();
+}
+
+inline int JobPool_ThreadCount (JobPool const * pool) {return 1 + int(pool->threads.size());}
+
+// Calls func(user, i) for every i in [0, count), spread over all threads.
+static inline void
+JobPool_Run (JobPool * pool, int count, JobFunc func, void * user) {
+    if (pool->threads.empty() || count <= 1) {
+        for (int i = 0; i < count; ++i)
+            func(user, i);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock (pool->mutex);
+        pool->func = func;
+        pool->user = user;
+        pool->job_count = count;
+        pool->next_job = 0;
+        pool->busy_workers = int(pool->threads.size());
+        pool->generation += 1;
+    }
+    pool->wake.notify_all();
+    JobPool_Work(pool);
+    std::unique_lock<std::mutex> lock (pool->mutex);
+    pool->done.wait(lock, [&]{return 0 == pool->busy_workers;});
+}
+
+template <typename F>
+static inline void
+JobPool_ForEach (JobPool * pool, int count, F & f) {
+    JobPool_Run(pool, count, [](void * user, int index){(*(F *)user)(index);}, &f);
+}
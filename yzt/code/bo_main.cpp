@@ -1,178 +1,308 @@
 #include <sdl2/SDL.h>
-#include <cassert>
-#include <cmath>
+#include <algorithm>
 #include <cstdio>
 #include <vector>
 
 //#define DRAW_BALL_HISTORY
 
-#if defined(NDEBUG)
-    #define ASSERT(cond, ...)   ((void)(cond))
-#else
-    #define ASSERT(cond, ...)   assert(cond)
-#endif
-using byte = unsigned char;
-
+#include "bo_common.hpp"
 #include "bo_math.hpp"
 #include "bo_render.hpp"
+#include "bo_drawlist.hpp"
+#include "bo_tiles.hpp"
+#include "bo_sim.hpp"
+#include "bo_input.hpp"
+#include "bo_record.hpp"
+#include "bo_pacer.hpp"
+#include "bo_profile.hpp"
 
 struct Config {
-    int target_fps = 120;
+    int target_fps = 120;           // the simulation ticks at its own rate, whatever this is
+    bool headless = false;          // no window; run uncapped and report
+    unsigned headless_frames = 1000;
+    unsigned checkpoint_every = 0;  // in headless mode; 0 means only the last frame
+    char const * dump_dir = nullptr;    // where checkpoint frames go, as PPM
+    char const * record_path = nullptr; // the input goes here, tick by tick
+    char const * replay_path = nullptr; // and comes from here instead of the player
+    double replay_speed = 1.0;
+    bool profile = false;           // show the phase timings (F3 toggles), and print them at exit
+    char const * profile_csv = nullptr; // every frame's phase timings go here
+    char const * trace_path = nullptr;  // a trace from the start (to the exit, or to F9) goes here
+    bool frame_input = false;       // read input once a frame, and hold it for all of its ticks
+    int render_threads = 0;     // 0 means one per CPU core; the ball update uses them too
     int window_width = 600;
     int window_height = 0;
     float window_aspect_ratio = 3.0f / 4.0f;
+    Color background_color = {0, 0, 0};
 
-    float paddle_speed = 1000.0f;
-    float paddle_vert_pos = 0.90f;
-    Vec2f paddle_half_dims = {80, 10};
-    float ball_radius = 10.0f;
-    float ball_speed = 700.0f;
-
-    Vec2f brick_half_dims = {40, 20};
-    Color brick_color = {50, 50, 250};
+    SimConfig sim;              // its field is the whole window
 };
 
 struct Input {
-    float movement = 0.0f; // in [-1..1]
+    SimInput sim;
     bool exit = false;
     bool action = false;
+    bool capture_frame = false;
+    bool toggle_profile = false;
+    bool toggle_trace = false;
 
     bool left_pressed = false;
     bool right_pressed = false;
 };
 
-struct State {
-    Point2f paddle_pos = {300, 300};
-    Point2f ball_pos = {};
-    Vec2f ball_dir = {};
-    bool ball_in_movement = false;
-};
-
-struct Brick {
-    Point2f pos;
-};
+// These are exactly the pixels the render section below touches for each
+// object; the dirty-region bookkeeping relies on that.
+static Rect PaddleRect (SimConfig const & config, Point2f const & paddle_pos) {
+    return Rect_OfAAB(
+        Round(paddle_pos.x - config.paddle_half_dims.x), Round(paddle_pos.y - config.paddle_half_dims.y),
+        Round(2 * config.paddle_half_dims.x), Round(2 * config.paddle_half_dims.y)
+    );
+}
 
+static Rect BallRect (SimConfig const & config, Point2f const & ball_pos) {
+    return Rect_OfCircle(Round(ball_pos.x), Round(ball_pos.y), Round(config.ball_radius));
+}
 
-struct CollisionResult {
-    bool exists;
-    Real param;
-    Point2f point;
-    Vec2f normal;
-};
 
-CollisionResult Collide_CircleAAB (
-    Point2f const & circle_pos, Real circle_radius, Vec2f const & circle_movement,   // ball_dir * ball_speed * time_step
-    Point2f const & aab_pos, Vec2f const & aab_half_dims, Vec2f const & aab_movement
-) {
-    CollisionResult ret = {};
-    //ret.param = 2.0f;   // +Inf
-    auto movement = circle_movement - aab_movement;
-    auto ball_expected = circle_pos + movement;
-
-    Point2f corners [4] = {
-        {aab_pos.x - aab_half_dims.x, aab_pos.y - aab_half_dims.y},
-        {aab_pos.x - aab_half_dims.x, aab_pos.y + aab_half_dims.y},
-        {aab_pos.x + aab_half_dims.x, aab_pos.y + aab_half_dims.y},
-        {aab_pos.x + aab_half_dims.x, aab_pos.y - aab_half_dims.y},
-    };
-    Vec2f normals [4] = {
-        {-1.0f, 0},
-        {0, +1.0f},
-        {+1.0f, 0},
-        {0, -1.0f},
-    };
-    for (int i = 0; i < 4; ++i) {
-        auto displacement = circle_radius * normals[i];
-        auto m0 = corners[i] + displacement;
-        auto m1 = corners[(i + 1) % 4] + displacement;
-        auto c = Intersect_LineLine(circle_pos, ball_expected, m0, m1);
-        if (c.exists && c.l_param > 0 && c.l_param <= 1.0f && c.m_param >= 0 && c.m_param <= 1.0f) {
-            if (!ret.exists || c.l_param < ret.param) {
-                ret.exists = true;
-                ret.param = c.l_param;
-                //ret.point = Lerp(m0, m1, c.m_param);
-                ret.point = Lerp(circle_pos, circle_pos + circle_movement, c.l_param);
-                ret.normal = normals[i];
-            }
-        }
-    }
+// The brick field only changes when a brick goes away (or appears), so it
+// lives pre-rendered, along with the background, in its own canvas, and
+// only the affected area of that is ever redrawn.
+static void
+BrickLayer_Redraw (Canvas * layer, Config const & config, BrickStore const & bricks, SpatialGrid * grid, Rect const & area) {
+    Canvas_SetClip(layer, area);
+    Render_Clear(layer, config.background_color);
+    // Inclusive on the far side, so bricks that only touch the area are
+    // asked about too; the clip sorts them out.
+    Point2f const lo = {float(area.x0), float(area.y0)}, hi = {float(area.x1), float(area.y1)};
+    SpatialGrid_Query(grid, lo, hi, [&](int slot){
+        int const i = bricks.index_of[slot];
+        Rect const br = BrickStore_Rect(&bricks, i);
+        if (Rect_Overlaps(br, layer->clip))
+            Render_AAB(layer, br, bricks.color[i]);
+    });
+    Canvas_ResetClip(layer);
+}
 
-    for (int i = 0; i < 4; ++i) {
-        auto c = Intersect_LineCircle(circle_pos, ball_expected, corners[i], circle_radius);
-        if (c.count >= 2) {
-            if (c.param1 <= 0 || (c.param2 > 0 && c.param2 < c.param1))
-                c.param1 = c.param2;
-            c.count = 1;
-        }
-        if (c.count >= 1 && c.param1 > 0 && c.param1 <= 1.0f) {
-            if (!ret.exists || c.param1 < ret.param) {
-                ret.exists = true;
-                ret.param = c.param1;
-                ret.point = Lerp(circle_pos, circle_pos + circle_movement, c.param1);
-                ret.normal = Normalize(ret.point - corners[i]);
-            }
+static bool
+ParseArgs (Config * config, int argc, char * argv []) {
+    for (int i = 1; i < argc; ++i) {
+        bool const has_value = i + 1 < argc;
+        if (0 == ::strcmp(argv[i], "--headless")) {
+            config->headless = true;
+            if (has_value && argv[i + 1][0] != '-')
+                config->headless_frames = unsigned(::strtoul(argv[++i], nullptr, 10));
+        } else if (0 == ::strcmp(argv[i], "--checkpoint") && has_value) {
+            config->checkpoint_every = unsigned(::strtoul(argv[++i], nullptr, 10));
+        } else if (0 == ::strcmp(argv[i], "--dump") && has_value) {
+            config->dump_dir = argv[++i];
+        } else if (0 == ::strcmp(argv[i], "--record") && has_value) {
+            config->record_path = argv[++i];
+        } else if (0 == ::strcmp(argv[i], "--replay") && has_value) {
+            config->replay_path = argv[++i];
+        } else if (0 == ::strcmp(argv[i], "--speed") && has_value) {
+            config->replay_speed = std::max(0.001, ::atof(argv[++i]));
+        } else if (0 == ::strcmp(argv[i], "--profile")) {
+            config->profile = true;
+        } else if (0 == ::strcmp(argv[i], "--profile-csv") && has_value) {
+            config->profile_csv = argv[++i];
+        } else if (0 == ::strcmp(argv[i], "--trace") && has_value) {
+            config->trace_path = argv[++i];
+        } else if (0 == ::strcmp(argv[i], "--frame-input")) {
+            config->frame_input = true;
+        } else if (0 == ::strcmp(argv[i], "--sim-hz") && has_value) {
+            config->sim.tick_hz = Max(1, atoi(argv[++i]));
+        } else if (0 == ::strcmp(argv[i], "--threads") && has_value) {
+            config->render_threads = atoi(argv[++i]);
+        } else if (0 == ::strcmp(argv[i], "--balls") && has_value) {
+            config->sim.serve_balls = Max(1, atoi(argv[++i]));
+        } else {
+            ::fprintf(stderr,
+                "usage: %s [--headless [frames]] [--checkpoint every_n_frames] [--dump dir]\n"
+                "          [--record file | --replay file [--speed x]] [--profile] [--profile-csv file]\n"
+                "          [--trace file] [--frame-input] [--sim-hz n] [--threads n] [--balls n]\n"
+                "  --headless     run without a window, uncapped, with the paddle on autopilot\n"
+                "  --checkpoint   in headless mode, print the frame hash every n frames\n"
+                "  --dump         and also write those frames into \"dir\" as PPM\n"
+                "  --record       write the input of every tick into \"file\"\n"
+                "  --replay       play a recorded game back, and check it ends up the same;\n"
+                "                 at x times real time (in headless mode, as fast as it goes)\n"
+                "  --profile      show how long each part of a frame takes (F3 toggles it),\n"
+                "                 and print percentiles of that at exit\n"
+                "  --profile-csv  write every frame's timings into \"file\"\n"
+                "  --trace        write a timeline from the start to the exit (or to F9)\n"
+                "                 into \"file\", for ui.perfetto.dev; F9 starts and stops\n"
+                "                 more of them, into trace_NNN.json\n"
+                "                 (only in builds with BO_TRACE; see YZT_TRACE in CMake)\n"
+                "  --frame-input  read the keys once a frame, before the update, and move\n"
+                "                 the paddle by that for the whole frame; the way it used\n"
+                "                 to be, for comparing the input latency (see --profile)\n"
+                "  --sim-hz       simulation ticks per second (default: 1000)\n"
+                "  --threads      how many threads render and update (default: one per core)\n"
+                "  --balls        put n balls into play with every serve\n",
+                argv[0]);
+            return false;
         }
     }
-
-    return ret;
+    return true;
 }
 
 int main (int argc, char * argv []) {
     Config config;
     Input input;
-    State state;
 
+    if (!ParseArgs(&config, argc, argv))
+        return 1;
     config.window_height = Round(config.window_width / config.window_aspect_ratio);
 
-    SDL_Init(SDL_INIT_VIDEO);
+    // A replay brings its own config; the field has to be just as it was.
+    InputReplay replay = {};
+    bool const replaying = nullptr != config.replay_path;
+    if (replaying) {
+        if (!InputReplay_Open(&replay, config.replay_path)) {
+            ::fprintf(stderr, "can't read the input log \"%s\"\n", config.replay_path);
+            return 1;
+        }
+        config.sim = replay.config;
+        config.window_width = config.sim.width;
+        config.window_height = config.sim.height;
+    }
+
+    SDL_Init(config.headless ? 0 : SDL_INIT_VIDEO);
+    Render_Init();
+    Collide_Init();
 
     SDL_Window * window = nullptr;
     SDL_Renderer * renderer = nullptr;
-    SDL_CreateWindowAndRenderer(config.window_width, config.window_height, 0 /*| SDL_WINDOW_FULLSCREEN*/, &window, &renderer);
-    SDL_GetWindowSize(window, &config.window_width, &config.window_height);
-    SDL_SetWindowTitle(window, "BrykOut");
-
-    SDL_Texture * tex = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, config.window_width, config.window_height);
-    SDL_assert(tex);
+    SDL_Texture * tex = nullptr;
+    if (!config.headless) {
+        SDL_CreateWindowAndRenderer(config.window_width, config.window_height, 0 /*| SDL_WINDOW_FULLSCREEN*/, &window, &renderer);
+        SDL_GetWindowSize(window, &config.window_width, &config.window_height);
+        SDL_SetWindowTitle(window, "BrykOut");
+
+        tex = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, config.window_width, config.window_height);
+        SDL_assert(tex);
+    }
 
-    state.paddle_pos = {
-        0.5f * config.window_width,
-        config.paddle_vert_pos * config.window_height
-    };
+    if (!replaying) {
+        config.sim.width = config.window_width;
+        config.sim.height = config.window_height;
+    }
 
     double target_frame_time_s = 1.0 / config.target_fps;
+    double const sim_dt = 1.0 / config.sim.tick_hz;
     double const inv_pfc_freq = 1.0 / SDL_GetPerformanceFrequency();
-    double next_frame_start_s = inv_pfc_freq * SDL_GetPerformanceCounter() + target_frame_time_s;
-    double wastage = 0.0;
+    FramePacer pacer = {};
+    if (!config.headless)
+        FramePacer_Init(&pacer, target_frame_time_s);
 
     #if defined(DRAW_BALL_HISTORY)
     std::vector<Point2f> ball_history;
+    size_t ball_history_drawn = 0;
     #endif
 
-    std::vector<Brick> bricks;
-    for (int i = 0; i < 8; ++i) {
-        for (int j = 0; j < 6; ++j) {
-            bricks.push_back({Point2f{
-                config.brick_half_dims.x + 48.0f + 84.0f * j,
-                config.brick_half_dims.y + 40.0f + 44.0f * i
-            }});
-        }
+    // Everything is drawn here first, and only the regions that changed
+    // get redrawn and then uploaded into the texture.
+    Canvas canvas = Canvas_Alloc(config.window_width, config.window_height);
+    DirtyRegion dirty = {};
+    DirtyRegion_Reset(&dirty, Canvas_Bounds(&canvas));
+    DirtyRegion_AddAll(&dirty);     // nothing's been drawn yet
+    Rect drawn_paddle = {};
+    std::vector<Rect> drawn_balls;
+    double dirty_pixels = 0.0;
+
+    // Before the render threads start, so a bad path has nothing else to
+    // stop. (These two have writer threads of their own.)
+    FrameProfiler * prof = new FrameProfiler;
+    if (!Profiler_Init(prof, config.profile_csv, config.headless)) {
+        ::fprintf(stderr, "can't write \"%s\"\n", config.profile_csv);
+        return 1;
+    }
+    InputRecorder recorder = {};
+    bool const recording = nullptr != config.record_path;
+    if (recording && !InputRecorder_Open(&recorder, config.record_path, config.sim)) {
+        ::fprintf(stderr, "can't write the input log \"%s\"\n", config.record_path);
+        Profiler_Close(prof);
+        delete prof;
+        return 1;
     }
 
+    JobPool render_pool;
+    JobPool_Start(&render_pool, config.render_threads > 0 ? config.render_threads : SDL_GetCPUCount());
+    TiledRenderer tiles;
+    TiledRenderer_Init(&tiles, &render_pool);
+    DrawList frame_draws = {};
+    DrawList_Init(&frame_draws, 256);
+    unsigned captured_frames = 0;   // F12 writes the current frame's draw list to disk
+
+    Sim sim;
+    Sim_Init(&sim, config.sim, &render_pool);
+    SimState const & state = sim.state;
+    BrickStore const & bricks = sim.bricks;
+#if defined(DRAW_BALL_HISTORY)
+    sim.trail = &ball_history;
+#endif
+    bool replay_done = false, replay_ok = true;
+
+    bool show_profile = config.profile && !config.headless;
+    Rect const profile_rect = Profiler_OverlayRect(8, config.window_height - 8 - ProfOverlayHeight);
+    unsigned captured_traces = 0;   // F9 stops one; it goes into the next trace_NNN.json
+    bool launch_trace = false;      // the one running is --trace's, which goes into its own file
+    auto save_trace = [](char const * path){
+        if (Trace_Write(path))
+            ::printf("wrote the trace into \"%s\"\n", path);
+        else
+            ::fprintf(stderr, "couldn't write the trace into \"%s\"\n", path);
+    };
+    auto start_trace = []{
+        Trace_Start();
+        if (!Trace_IsOn())
+            ::fprintf(stderr, "this build can't trace; it needs BO_TRACE defined\n");
+    };
+    if (config.trace_path) {
+        start_trace();
+        launch_trace = true;
+    }
+    // Stops the trace that's running, and writes it wherever it goes.
+    auto stop_trace = [&]{
+        char path [64];
+        if (!launch_trace)
+            ::snprintf(path, sizeof(path), "trace_%03u.json", captured_traces++);
+        Trace_Stop();
+        save_trace(launch_trace ? config.trace_path : path);
+        launch_trace = false;
+    };
+
+    Canvas brick_layer = Canvas_Alloc(config.window_width, config.window_height);
+    BrickLayer_Redraw(&brick_layer, config, bricks, &sim.grid, Canvas_Bounds(&brick_layer));
+    DrawList_SetLayer(&frame_draws, 0, &brick_layer);
+
     SDL_Event ev = {};
     unsigned t0 = SDL_GetTicks();
     unsigned frame_count = 0;
-    for (;;) {
-        // Process pending events...
-        input.action = false;
-        input.exit = false;
+    unsigned frame_index = 0;       // never reset
+    double const run_start_s = inv_pfc_freq * SDL_GetPerformanceCounter();
+    uint64_t frame_hash = 0;
+    double sim_clock_s = run_start_s;
+    double sim_behind_s = 0.0;      // simulated time owed; less than a tick after the update
+
+    // The paddle keys go into the timeline with when they were pressed or
+    // released; the ticks take them from there. The events get pumped at
+    // the start of the frame, and (unless it's --frame-input) all through
+    // the wait before it, so none of them sit in the queue for long.
+    InputTimeline timeline;
+    InputTimeline_Init(&timeline, run_start_s);
+    double last_pump_s = run_start_s;
+    auto poll_events = [&]{
+        double const pump_s = Pacer_Now();
+        Uint32 const pump_ms = SDL_GetTicks();
         while (SDL_PollEvent(&ev)) {
             switch (ev.type) {
             case SDL_KEYDOWN:
                 switch (ev.key.keysym.sym) {
                 case SDLK_a: case SDLK_LEFT: input.left_pressed = true; break;
                 case SDLK_d: case SDLK_RIGHT: input.right_pressed = true; break;
-                case SDLK_SPACE: input.action = true;
+                case SDLK_SPACE: input.action = true; break;
+                case SDLK_m: input.sim.split_balls = true;
                 }
                 break;
             case SDL_KEYUP:
@@ -180,238 +310,319 @@ int main (int argc, char * argv []) {
                 case SDLK_a: case SDLK_LEFT: input.left_pressed = false; break;
                 case SDLK_d: case SDLK_RIGHT: input.right_pressed = false; break;
                 case SDLK_ESCAPE: input.exit = true; break;
+                case SDLK_F12: input.capture_frame = true; break;
+                case SDLK_F3: input.toggle_profile = true; break;
+                case SDLK_F9: input.toggle_trace = true; break;
                 }
                 break;
             case SDL_QUIT:
                 input.exit = true;
                 break;
             }
+            if (SDL_KEYDOWN == ev.type || SDL_KEYUP == ev.type) {
+                // It came in with this pump, so it happened since the last
+                // one; if SDL's own (millisecond) timestamp says it's been
+                // waiting a while, it knows better.
+                double time_s = pump_s;
+                int const age_ms = int(pump_ms - ev.common.timestamp);
+                if (age_ms >= 2)
+                    time_s = std::max(last_pump_s, pump_s - 0.001 * age_ms);
+                InputTimeline_Keys(&timeline, time_s, input.left_pressed, input.right_pressed);
+            }
         }
+        last_pump_s = pump_s;
+    };
+
+    for (;;) {
+        Profiler_NextFrame(prof);
+        TRACE_FRAME(frame_index);
+
+        // Process pending events...
+        if (!config.headless)
+            poll_events();
+        if (config.headless) {
+            // Nobody's at the keyboard.
+            SimInput const autopilot = Sim_Autopilot(&sim);
+            input.action = autopilot.serve;
+            input.left_pressed = autopilot.movement < 0;
+            input.right_pressed = autopilot.movement > 0;
+            input.exit = !replaying && frame_index >= config.headless_frames;
+        }
+        if (replay_done)
+            input.exit = true;
+        Profiler_Mark(prof, Prof_Events);
 
         // Process the input...
         if (input.exit)
             break;
 
         if (input.left_pressed && !input.right_pressed)
-            input.movement = -1.0f;
+            input.sim.movement = -1.0f;
         else if (input.right_pressed && !input.left_pressed)
-            input.movement = 1.0f;
+            input.sim.movement = 1.0f;
         else
-            input.movement = 0.0f;
+            input.sim.movement = 0.0f;
+        input.sim.serve = input.action;
 
+    #if defined(DRAW_BALL_HISTORY)
         if (input.action && !state.ball_in_movement) {
-            state.ball_in_movement = true;
-            state.ball_dir = Normalize({(input.movement >= 0 ? 1.0f : -1.0f), -1.0f});
-        #if defined(DRAW_BALL_HISTORY)
             ball_history.clear();
-            ball_history.push_back(state.ball_pos);
-        #endif
+            ball_history.push_back(BallStore_Pos(&state.balls, 0));
+            ball_history_drawn = 0;
+            DirtyRegion_AddAll(&dirty);     // the old trail has to go
         }
-
-        // Do the update...
-        State next = state;
-        next.paddle_pos.x += input.movement * config.paddle_speed * float(target_frame_time_s);
-        if (next.paddle_pos.x < config.paddle_half_dims.x)
-            next.paddle_pos.x = config.paddle_half_dims.x;
-        if (next.paddle_pos.x > config.window_width - config.paddle_half_dims.x)
-            next.paddle_pos.x = config.window_width - config.paddle_half_dims.x;
-        
-        if (!state.ball_in_movement) {
-            next.ball_pos = {
-                next.paddle_pos.x,
-                next.paddle_pos.y - config.paddle_half_dims.y - config.ball_radius
-            };
-        } else {
-            Real const R = config.ball_radius;
-            Point2f const corners [4] = {
-                {0 + R, 0 + R},
-                {0 + R, config.window_height - R},
-                {config.window_width - R, config.window_height - R},
-                {config.window_width - R, 0 + R},
-            };
-            Vec2f const normals [4] = {
-                {+1.0f, 0.0f},
-                { 0.0f,-1.0f},
-                {-1.0f, 0.0f},
-                { 0.0f,+1.0f},
-            };
-
-            //next.ball_pos = state.ball_pos + state.ball_dir * (config.ball_speed * float(target_frame_time_s));
-
-            Real rem = 1.0f;
-            auto bp = next.ball_pos;
-            auto bd = next.ball_dir;
-
-            //if (next.ball_pos.y + config.ball_radius <= next.paddle_pos.y - config.paddle_half_dims.y) {
-                auto paddle_collision = Collide_CircleAAB(
-                    state.ball_pos, config.ball_radius, state.ball_dir * (config.ball_speed * float(target_frame_time_s) * rem),
-                    state.paddle_pos, config.paddle_half_dims, next.paddle_pos - state.paddle_pos
-                );
-                if (paddle_collision.exists) {
-                    bp = paddle_collision.point;
-                    bd = Normalize(Reflect(bd, paddle_collision.normal));
-                    rem -= paddle_collision.param * rem;
-                    #if defined(DRAW_BALL_HISTORY)
-                        ball_history.push_back(paddle_collision.point);
-                    #endif
-                }
-            //}
-
-            while (rem > 0.001f) {
-                auto ep = bp + bd * (config.ball_speed * float(target_frame_time_s) * rem);
-                bool collides_with_walls = false;
-                for (int i = 0; i < 4; ++i) {
-                    auto r = Intersect_LineLine(bp, ep, corners[i], corners[(i + 1) % 4]);
-                    if (r.exists && r.l_param > 0 && r.l_param <= 1.0f && r.m_param >= 0 && r.m_param <= 1.0f) {
-                        auto cp = Lerp(corners[i], corners[(i + 1) % 4], r.m_param);
-                        auto cn = normals[i];
-                        auto cd = Normalize(Reflect(bd, cn));
-                        auto ct = r.l_param;
-
-                        bp = cp;
-                        bd = cd;
-                    #if defined(DRAW_BALL_HISTORY)
-                        ball_history.push_back(cp);
-                    #endif
-
-                        rem -= ct * rem;
-                        //rem = (1 - ct) * rem;
-                        collides_with_walls = true;
-
-                        if (1 == i) {
-                            // Lost the ball!
-                            next.ball_in_movement = false;
-                        }
-                        break;
-                    }
-                }
-                if (!collides_with_walls) {
-                    //bp = ep;
-                    //rem = 0.0f;
-                    break;
-                }
+    #endif
+        if (!replaying)
+            Sim_Act(&sim, input.sim);
+        if (recording)
+            InputRecorder_Act(&recorder, input.sim);
+        if (input.toggle_profile) {
+            show_profile = !show_profile;
+            DirtyRegion_Add(&dirty, profile_rect);
+        }
+        if (input.toggle_trace) {
+            // Nothing else is running between frames, so it's safe to write.
+            if (Trace_IsOn())
+                stop_trace();
+            else
+                start_trace();
+        }
+        Profiler_Mark(prof, Prof_Input);
+
+        // Do the update, in fixed ticks however long the frame took; what's
+        // left over is how far into the next tick the render shows things.
+        double const update_start_s = inv_pfc_freq * SDL_GetPerformanceCounter();
+        sim_behind_s += (config.headless ? target_frame_time_s : std::min(update_start_s - sim_clock_s, 0.25)) * (replaying ? config.replay_speed : 1.0);
+        sim_clock_s = update_start_s;
+        if (replaying) {
+            uint64_t until_tick = sim.ticks;
+            for (; sim_behind_s >= sim_dt; sim_behind_s -= sim_dt)
+                until_tick += 1;
+            if (!InputReplay_Advance(&replay, &sim, until_tick)) {
+                replay_ok = InputReplay_Check(&replay, &sim);
+                replay_done = true;
             }
-
-            // Collision(s) with bricks...
-            while (rem > 0.001f) {
-                auto bm = bd * (config.ball_speed * float(target_frame_time_s) * rem);
-                bool collides_with_bricks = false;
-                for (unsigned i = 0, n = unsigned(bricks.size()); i < n; ++i) {
-                    auto brick_collision = Collide_CircleAAB(
-                        bp, config.ball_radius, bm,
-                        bricks[i].pos, config.brick_half_dims, {0.0f, 0.0f}
-                    );
-                    if (brick_collision.exists) {
-                        bp = brick_collision.point;
-                        bd = Normalize(Reflect(bd, brick_collision.normal));
-                        rem -= brick_collision.param * rem;
-                        #if defined(DRAW_BALL_HISTORY)
-                            ball_history.push_back(brick_collision.point);
-                        #endif
-
-                        bricks.erase(bricks.begin() + i);
-
-                        collides_with_bricks = true;
-                        break;
-                    }
-                }
-                if (!collides_with_bricks) {
-                    bp = bp + bm;
-                    rem = 0.0f;
-                    break;
+        } else {
+            for (; sim_behind_s >= sim_dt; sim_behind_s -= sim_dt) {
+                if (!config.headless) {
+                    // The stretch of real time this tick stands for.
+                    double const tick_start_s = update_start_s - sim_behind_s;
+                    float const movement = InputTimeline_Take(&timeline, tick_start_s, tick_start_s + sim_dt);
+                    if (!config.frame_input)
+                        input.sim.movement = movement;
                 }
+                Sim_Tick(&sim, input.sim);
+                if (recording)
+                    InputRecorder_Tick(&recorder, input.sim);
             }
-
-            next.ball_pos = bp;
-            next.ball_dir = bd;
-        #if defined(DRAW_BALL_HISTORY)
-            ball_history.push_back(bp);
-        #endif
         }
-        
-        state = next;
+        TRACE_COUNTER("balls", state.balls.count);
+        TRACE_COUNTER("bricks", bricks.count);
+        Profiler_Mark(prof, Prof_Sim);
+        for (Rect const & gone : sim.removed) {
+            BrickLayer_Redraw(&brick_layer, config, bricks, &sim.grid, gone);
+            DirtyRegion_Add(&dirty, gone);
+        }
+        sim.removed.clear();
+        float const alpha = float(sim_behind_s / sim_dt);
+        Profiler_Mark(prof, Prof_Layer);
 
         // Do the render...
-        Canvas canvas = {};
-        SDL_LockTexture(tex, nullptr, &canvas.pixels_raw, &canvas.pitch_bytes);
-        canvas.width = config.window_width;
-        canvas.height = config.window_height;
+        DirtyRegion_Add(&dirty, drawn_paddle);
+        for (Rect const & r : drawn_balls)
+            DirtyRegion_Add(&dirty, r);
+        drawn_paddle = PaddleRect(config.sim, Lerp(state.paddle_prev_pos, state.paddle_pos, alpha));
+        drawn_balls.resize(state.balls.count);
+        for (int b = 0; b < state.balls.count; ++b)
+            drawn_balls[b] = BallRect(config.sim, BallStore_Lerp(&state.balls, b, alpha));
+        DirtyRegion_Add(&dirty, drawn_paddle);
+        for (Rect const & r : drawn_balls)
+            DirtyRegion_Add(&dirty, r);
+
+    #if defined(DRAW_BALL_HISTORY)
+        for (size_t i = (ball_history_drawn > 0 ? ball_history_drawn : 1); i < ball_history.size(); ++i)
+            DirtyRegion_Add(&dirty, Rect_Union(
+                Rect_OfCircle(Round(ball_history[i - 1].x), Round(ball_history[i - 1].y), 2),
+                Rect_OfCircle(Round(ball_history[i - 0].x), Round(ball_history[i - 0].y), 2)
+            ));
+        ball_history_drawn = ball_history.size();
+    #endif
 
-        Render_Clear(&canvas, {0, 0, 0});
+        // The whole frame is recorded, but only what falls inside the dirty
+        // rects gets rasterized; in list order, so the result is the same
+        // as redrawing everything.
+        DrawList_Reset(&frame_draws);
+        int draw_count = 1 + (input.capture_frame ? bricks.count : 0)  // the layer, or the clear and the bricks
+                       + 1 + state.balls.count                         // the paddle and the balls
+                       + (show_profile ? ProfOverlayCommands : 0);
+    #if defined(DRAW_BALL_HISTORY)
+        draw_count += int(2 * ball_history.size());
+    #endif
+        DrawList_Reserve(&frame_draws, draw_count);
+        if (input.capture_frame) {
+            // A saved list has to stand on its own, so the brick layer is
+            // spelled out; it draws the exact same pixels.
+            DrawList_Clear(&frame_draws, config.background_color);
+            for (int i = 0; i < bricks.count; ++i)
+                DrawList_AAB(&frame_draws, BrickStore_Rect(&bricks, i), bricks.color[i]);
+        } else {
+            DrawList_Layer(&frame_draws, 0);
+        }
 
     #if defined(DRAW_BALL_HISTORY)
         for (unsigned i = 1; i < ball_history.size(); ++i)
-            Render_Line(
-                &canvas, 
+            DrawList_Line(
+                &frame_draws,
                 Round(ball_history[i - 1].x), Round(ball_history[i - 1].y),
                 Round(ball_history[i - 0].x), Round(ball_history[i - 0].y),
                 {0, 255, 255}
             );
         for (auto const & p : ball_history)
-            Render_Circle(&canvas, Round(p.x), Round(p.y), 2, {0, 255, 255});
+            DrawList_Circle(&frame_draws, Round(p.x), Round(p.y), 2, {0, 255, 255});
     #endif
 
-        Render_AAB(
-            &canvas,
-            Round(state.paddle_pos.x - config.paddle_half_dims.x), Round(state.paddle_pos.y - config.paddle_half_dims.y),
-            Round(2 * config.paddle_half_dims.x), Round(2 * config.paddle_half_dims.y),
-            {255, 0, 0}
-        );
-
-        for (auto const & b : bricks)
-            Render_AAB(
-                &canvas,
-                Round(b.pos.x - config.brick_half_dims.x), Round(b.pos.y - config.brick_half_dims.y),
-                Round(2 * config.brick_half_dims.x), Round(2 * config.brick_half_dims.y),
-                config.brick_color
-            );
+        DrawList_AAB(&frame_draws, drawn_paddle, {255, 0, 0});
 
-        Render_Circle(
-            &canvas,
-            Round(state.ball_pos.x), Round(state.ball_pos.y),
-            Round(config.ball_radius),
-            {0, 255, 0}
-        );
+        for (int b = 0; b < state.balls.count; ++b) {
+            Point2f const p = BallStore_Lerp(&state.balls, b, alpha);
+            DrawList_Circle(&frame_draws, Round(p.x), Round(p.y), Round(config.sim.ball_radius), {0, 255, 0});
+        }
 
-        SDL_UnlockTexture(tex);
+        if (show_profile) {
+            Profiler_DrawOverlay(prof, &frame_draws, profile_rect.x0, profile_rect.y0, target_frame_time_s);
+            DirtyRegion_Add(&dirty, profile_rect);
+        }
+
+        if (input.capture_frame) {
+            char path [64];
+            ::snprintf(path, sizeof(path), "frame_%06u.bodl", captured_frames++);
+            DrawList_Save(&frame_draws, canvas.width, canvas.height, path);
+        }
+
+        Rect dirty_bounds = {};
+        for (int d = 0; d < dirty.count; ++d)
+            dirty_bounds = (0 == d ? dirty.rects[d] : Rect_Union(dirty_bounds, dirty.rects[d]));
+        DrawList_Optimize(&frame_draws, dirty_bounds);
+        Profiler_Mark(prof, Prof_Record);
+        TiledRenderer_Execute(&tiles, &canvas, &frame_draws, dirty.rects, dirty.count);
+        Profiler_Mark(prof, Prof_Raster);
+
+        dirty_pixels += double(DirtyRegion_Area(&dirty));
+        frame_index += 1;
+
+        if (config.headless) {
+            bool const last = (replaying ? replay_done : frame_index == config.headless_frames);
+            if (last || (config.checkpoint_every > 0 && 0 == frame_index % config.checkpoint_every)) {
+                frame_hash = Canvas_Hash(&canvas);
+                ::printf("frame %6u  hash %016llx\n", frame_index, (unsigned long long)frame_hash);
+                if (config.dump_dir) {
+                    char path [512];
+                    ::snprintf(path, sizeof(path), "%s/frame_%06u.ppm", config.dump_dir, frame_index);
+                    if (!Canvas_SavePPM(&canvas, path))
+                        ::fprintf(stderr, "Couldn't write \"%s\".\n", path);
+                }
+            }
+            DirtyRegion_Reset(&dirty, Canvas_Bounds(&canvas));
+            continue;   // uncapped, and there's nothing to show
+        }
+
+        for (int d = 0; d < dirty.count; ++d) {
+            Rect const & dr = dirty.rects[d];
+            SDL_Rect sr = {dr.x0, dr.y0, dr.x1 - dr.x0, dr.y1 - dr.y0};
+            SDL_UpdateTexture(tex, &sr, canvas.pixel(dr.x0, dr.y0), canvas.pitch_bytes);
+        }
+        DirtyRegion_Reset(&dirty, Canvas_Bounds(&canvas));
+        Profiler_Mark(prof, Prof_Upload);
 
         //SDL_RenderClear(renderer);
         SDL_RenderCopy(renderer, tex, nullptr, nullptr);
         SDL_RenderPresent(renderer);
+        double const input_s = InputTimeline_TakeFirstUsed(&timeline);
+        if (input_s > 0)
+            Profiler_AddLatency(prof, Pacer_Now() - input_s);
+        Profiler_Mark(prof, Prof_Present);
 
         // FPS counter ...
         frame_count += 1;
         unsigned param1 = SDL_GetTicks();
         if (param1 - t0 >= 1 * 1000) {
-            char buffer [200];
+            double const waited_s = pacer.slept_s + pacer.spun_s;
+            ProfStats const latency = Profiler_LatencyStats(prof);
+            char buffer [320];
             ::snprintf(buffer, sizeof(buffer)
-                , "BrykOut    [FPS = %7.2f, frame time = %7.2fms, wastage = %7.2fms (%4.1f%%)]"
+                , "BrykOut    [FPS = %7.2f, frame time = %7.2fms, waiting = %6.2fms (%3.0f%% spun)"
+                  ", late p50/p99/max = %.0f/%.0f/%.0fus, missed = %d, dirty = %4.1f%%, input lag p50/p99 = %.1f/%.1fms]"
                 , double(frame_count) / (param1 - t0) * 1000
                 , double(param1 - t0) / frame_count
-                , 1000 * wastage / frame_count
-                , (1000 * wastage) / double(param1 - t0) * 100
+                , 1000 * waited_s / frame_count
+                , waited_s > 0 ? pacer.spun_s / waited_s * 100 : 0.0
+                , FramePacer_LatePercentile(&pacer, 0.5) * 1e6
+                , FramePacer_LatePercentile(&pacer, 0.99) * 1e6
+                , FramePacer_LatePercentile(&pacer, 1.0) * 1e6
+                , pacer.missed
+                , dirty_pixels / (double(frame_count) * canvas.width * canvas.height) * 100
+                , latency.p50 * 1e3
+                , latency.p99 * 1e3
             );
             SDL_SetWindowTitle(window, buffer);
 
             t0 = param1;
             frame_count = 0;
-            wastage = 0;
+            pacer.slept_s = pacer.spun_s = 0;
+            pacer.missed = 0;
+            dirty_pixels = 0;
         }
 
-        // Waste the rest of the frame time...
-        double now_s = inv_pfc_freq * SDL_GetPerformanceCounter();
-        double waste_start = now_s;
-        while (now_s < next_frame_start_s) {
-            SDL_Delay(0);
-            now_s = inv_pfc_freq * SDL_GetPerformanceCounter();
-        }
-        next_frame_start_s += target_frame_time_s;
-        wastage += now_s - waste_start;
+        // The one-off inputs have all been dealt with; whatever comes in
+        // from here on is for the next frame.
+        input.action = false;
+        input.exit = false;
+        input.capture_frame = false;
+        input.toggle_profile = false;
+        input.toggle_trace = false;
+        input.sim.split_balls = false;
+
+        // Sleep through the rest of the frame time...
+        if (config.frame_input)
+            FramePacer_Wait(&pacer);
+        else
+            FramePacer_Wait(&pacer, poll_events);
+        Profiler_Mark(prof, Prof_Wait);
+    }
+
+    if (config.headless && frame_index > 0) {
+        double const run_s = inv_pfc_freq * SDL_GetPerformanceCounter() - run_start_s;
+        ::printf("%u frames of %dx%d in %.3f s  (%.1f fps, %.3f ms/frame, %.1f%% dirty)  final hash %016llx\n",
+            frame_index, canvas.width, canvas.height, run_s, frame_index / run_s, run_s / frame_index * 1e3,
+            dirty_pixels / (double(frame_index) * canvas.width * canvas.height) * 100,
+            (unsigned long long)frame_hash);
+        if (sim.ball_steps > 0)
+            ::printf("%.0f ball ticks, %.1f%% of them with nothing to hit\n", sim.ball_steps, sim.quiet_ball_steps / sim.ball_steps * 100);
     }
 
-    SDL_DestroyTexture(tex);
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
+    if (Trace_IsOn())
+        stop_trace();
+    if (config.profile)
+        Profiler_Print(prof, stdout);
+    if (uint64_t const dropped = Profiler_Close(prof))
+        ::fprintf(stderr, "%llu frames didn't make it into \"%s\"\n", (unsigned long long)dropped, config.profile_csv);
+    delete prof;
+
+    if (recording && !InputRecorder_Close(&recorder, &sim))
+        ::fprintf(stderr, "couldn't write all of the input log \"%s\"\n", config.record_path);
+    if (replaying && !replay_done)
+        ::printf("replay: stopped at tick %llu, before the log ran out\n", (unsigned long long)sim.ticks);
+
+    DrawList_Free(&frame_draws);
+    JobPool_Stop(&render_pool);
+    Canvas_Free(&brick_layer);
+    Canvas_Free(&canvas);
+    if (tex)
+        SDL_DestroyTexture(tex);
+    if (renderer)
+        SDL_DestroyRenderer(renderer);
+    if (window)
+        SDL_DestroyWindow(window);
     SDL_Quit();
-    return 0;
+    return replay_ok ? 0 : 1;
 }
@@ -1,3 +1,7 @@
+#pragma once
+
+#include "bo_common.hpp"
+#include "bo_trace.hpp"
 #include <cmath>
 
 using Real = float;
@@ -39,6 +43,8 @@ inline Vec2f & operator /= (Vec2f & v, Real x) {v.x /= x; v.y /= x; return v;}
 
 inline int Min (int a, int b) {return b < a ? b : a;}
 inline int Max (int a, int b) {return b < a ? a : b;}
+inline long long Min (long long a, long long b) {return b < a ? b : a;}
+inline long long Max (long long a, long long b) {return b < a ? a : b;}
 inline Real Min (Real a, Real b) {return b < a ? b : a;}
 inline Real Max (Real a, Real b) {return b < a ? a : b;}
 
@@ -116,6 +122,7 @@ inline LineLineIntersectResult Intersect_LineLine (
     Point2f const & l0, Point2f const & l1,
     Point2f const & m0, Point2f const & m1
 ) {
+    PROFILE_SCOPE_HOT("Intersect_LineLine");
     LineLineIntersectResult ret = {};
     auto d = l1 - l0;
     auto e = m1 - m0;
@@ -139,6 +146,7 @@ inline LineCircleIntersectResult Intersect_LineCircle (
     Point2f const & l0, Point2f const & l1,
     Point2f const & c, Real r
 ) {
+    PROFILE_SCOPE_HOT("Intersect_LineCircle");
     LineCircleIntersectResult ret = {};
     auto d = l1 - l0;
     auto dd = Dot(d, d);
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "bo_common.hpp"
+#include <algorithm>
+#include <sdl2/SDL_timer.h>
+
+// Waits for the start of the next frame without keeping a core busy: it
+// sleeps for most of the wait, and only spins for the last bit, which is
+// about as long as the OS can oversleep. How long that is gets measured at
+// startup, and then follows the worst of the recent sleeps.
+//
+// How late each frame actually started is kept for the last
+// FramePacer::History frames, for the percentiles in the window title.
+
+struct FramePacer {
+    static constexpr int History = 256;
+    static constexpr int Sleeps = 32;
+
+    double period_s;
+    double next_s;              // when the next frame is due
+    double spin_s;              // the part of a wait that's spun, not slept
+
+    float overshoot_s [Sleeps]; // how far past the time asked for recent sleeps went; a ring
+    int sleep_count;
+
+    float late_s [History];     // per frame; a ring
+    int late_count;
+    int missed;                 // frames that were already late before waiting
+    double slept_s, spun_s;     // since the last report
+};
+
+inline double Pacer_Now () {return double(SDL_GetPerformanceCounter()) / double(SDL_GetPerformanceFrequency());}
+
+// Adds a sleep that went "overshoot_s" too long, and sets the spin time to
+// cover the worst of the recent ones.
+static inline void
+FramePacer_AddSleep (FramePacer * pacer, double overshoot_s) {
+    pacer->overshoot_s[pacer->sleep_count++ % FramePacer::Sleeps] = float(std::max(overshoot_s, 0.0));
+    int const n = std::min(pacer->sleep_count, int(FramePacer::Sleeps));
+    pacer->spin_s = *std::max_element(pacer->overshoot_s, pacer->overshoot_s + n) + 0.0002;
+}
+
+static inline void
+FramePacer_Init (FramePacer * pacer, double period_s) {
+    *pacer = {};
+    pacer->period_s = period_s;
+
+    // A handful of the shortest sleeps there are; how far past the asked
+    // for millisecond they go is how early a wait has to stop sleeping.
+    for (int i = 0; i < 8; ++i) {
+        double const start = Pacer_Now();
+        SDL_Delay(1);
+        FramePacer_AddSleep(pacer, Pacer_Now() - start - 0.001);
+    }
+    pacer->next_s = Pacer_Now() + period_s;
+}
+
+// Returns once the next frame is due (and as soon as it's due.) Calls
+// "between" every time it wakes up; then it sleeps a millisecond at a
+// time, so whatever that does (pumping events) happens often enough.
+template <typename F>
+static inline double
+FramePacer_Wait (FramePacer * pacer, F && between, unsigned max_sleep_ms = 1) {
+    double const deadline = pacer->next_s;
+    double const wake_s = deadline - pacer->spin_s;
+    double const wait_start = Pacer_Now();
+    double now = wait_start;
+    if (now > deadline)
+        pacer->missed += 1;
+
+    bool slept = false;
+    while (wake_s - now >= 0.001) {
+        unsigned const ms = std::min(unsigned((wake_s - now) * 1000), max_sleep_ms);
+        SDL_Delay(ms);
+        double const woke = Pacer_Now();
+        FramePacer_AddSleep(pacer, woke - now - 0.001 * ms);
+        between();
+        now = Pacer_Now();
+        slept = true;
+    }
+    if (!slept && now < deadline) {
+        // Spinning through a whole wait tells us nothing about sleeps, so
+        // pretend one went a little better than feared; otherwise one bad
+        // patch would leave the pacer spinning for good.
+        FramePacer_AddSleep(pacer, 0.9 * (pacer->spin_s - 0.0002));
+    }
+    double const spin_start = now;
+    while (now < deadline) {
+        SDL_Delay(0);   // gives the core up if anyone else wants it, but comes right back
+        between();
+        now = Pacer_Now();
+    }
+
+    pacer->slept_s += spin_start - wait_start;
+    pacer->spun_s += now - spin_start;
+    pacer->late_s[pacer->late_count++ % FramePacer::History] = float(now - deadline);
+
+    // A frame that overran by more than a whole period doesn't get the
+    // lost frames made up in a burst; the schedule starts over from now.
+    pacer->next_s += pacer->period_s;
+    if (now - pacer->next_s > pacer->period_s)
+        pacer->next_s = now + pacer->period_s;
+    return now;
+}
+
+static inline double
+FramePacer_Wait (FramePacer * pacer) {
+    return FramePacer_Wait(pacer, []{}, ~0u);
+}
+
+// How late frames started, in seconds, at percentile "p" (in [0..1]) of
+// the recent ones; 1 is the worst.
+static inline double
+FramePacer_LatePercentile (FramePacer const * pacer, double p) {
+    int const n = std::min(pacer->late_count, int(FramePacer::History));
+    if (n <= 0)
+        return 0.0;
+    float sorted [FramePacer::History];
+    std::copy(pacer->late_s, pacer->late_s + n, sorted);
+    std::sort(sorted, sorted + n);
+    return sorted[std::min(n - 1, int(p * n))];
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "bo_common.hpp"
+#include <thread>
+
+#if defined(_MSC_VER) && defined(BO_ARCH_X86)
+    #include <intrin.h>
+#endif
+
+// What the simulation needs to know about the machine: which kernels the
+// CPU can run and how many threads are worth starting. Asked of the CPU
+// directly, so the sim doesn't need SDL (or anything else) to be linked in.
+
+#if defined(_MSC_VER) && defined(BO_ARCH_X86)
+// One feature bit: "reg" is 0..3 for EAX..EDX.
+static inline bool
+Platform_CPUID (int leaf, int reg, int bit) {
+    int regs [4] = {};
+    __cpuid(regs, 0);
+    if (regs[0] < leaf)
+        return false;
+    __cpuidex(regs, leaf, 0);
+    return 0 != (regs[reg] & (1 << bit));
+}
+
+// AVX2 needs the OS to save the YMM registers too, not just the CPU bit.
+static inline bool
+Platform_OSSavesYMM () {
+    return Platform_CPUID(1, 2, 27)         // OSXSAVE
+        && 6 == (_xgetbv(0) & 6);           // XMM and YMM state
+}
+#endif
+
+static inline bool
+Platform_HasSSE2 () {
+#if defined(_MSC_VER) && defined(BO_ARCH_X86)
+    return Platform_CPUID(1, 3, 26);
+#elif defined(BO_ARCH_X86)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+#else
+    return false;
+#endif
+}
+
+static inline bool
+Platform_HasAVX2 () {
+#if defined(_MSC_VER) && defined(BO_ARCH_X86)
+    return Platform_CPUID(1, 2, 28)         // AVX
+        && Platform_CPUID(7, 1, 5)          // AVX2
+        && Platform_OSSavesYMM();
+#elif defined(BO_ARCH_X86)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");  // checks the OS side too
+#else
+    return false;
+#endif
+}
+
+// Only defined when the compiler was already allowed to use it.
+static inline bool
+Platform_HasNEON () {
+#if defined(BO_ARCH_NEON)
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Logical cores; at least 1.
+static inline int
+Platform_CPUCount () {
+    unsigned const n = std::thread::hardware_concurrency();
+    return n > 0 ? int(n) : 1;
+}
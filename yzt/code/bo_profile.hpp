@@ -0,0 +1,305 @@
+#pragma once
+
+#include "bo_common.hpp"
+#include "bo_drawlist.hpp"
+#include "bo_trace.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <sdl2/SDL_timer.h>
+
+// Where each frame's time goes. The main loop marks the end of each of its
+// phases, and the profiler keeps the last few hundred frames for
+// percentiles (printed at exit, and drawn as bars over the game), and can
+// stream every frame out as CSV.
+//
+// The CSV goes through a ring that only the main thread writes and only
+// the writer thread reads, each side owning one index; neither ever
+// waits for the other. If the writer falls a whole ring behind, frames
+// are left out of the file (and counted) rather than holding up the game;
+// unless it's asked to be lossless, for runs where nobody's watching.
+//
+// Separately, it keeps how long inputs took to get onto the screen: from
+// a key going down or up to the present of the first frame that had it in.
+// That's as far as it can see; the display adds its own on top.
+//
+// While a trace is being taken (see bo_trace.hpp), each phase also goes
+// into it as a span.
+
+enum ProfPhase {
+    Prof_Events,        // the event pump
+    Prof_Input,         // turning it into the sim's input
+    Prof_Sim,           // the ticks: movement and collisions
+    Prof_Layer,         // redrawing where bricks went away
+    Prof_Record,        // the frame's draw list
+    Prof_Raster,        // the dirty rects
+    Prof_Upload,        // into the texture
+    Prof_Present,
+    Prof_Wait,          // for the next frame to be due
+    Prof_PhaseCount
+};
+
+inline char const * const g_prof_phase_names [Prof_PhaseCount] = {
+    "events", "input", "sim", "layer", "record", "raster", "upload", "present", "wait",
+};
+
+struct ProfFrame {
+    uint64_t index;
+    float phase_s [Prof_PhaseCount];
+};
+
+struct ProfStats {
+    float p50, p95, p99, max;   // seconds
+};
+
+struct FrameProfiler {
+    static constexpr int History = 512;     // frames the percentiles look at
+    static constexpr int RingSize = 1024;   // a power of two
+
+    double inv_freq;
+    uint64_t mark;              // when the current phase started
+    ProfFrame current;
+    ProfFrame history [History];
+    uint64_t frame_count;
+    bool started;               // whether a frame is being marked
+    uint64_t trace_mark;        // the same as "mark", in trace time; 0 while not tracing
+
+    ProfStats stats [Prof_PhaseCount + 1];  // the last one is the whole frame
+    uint64_t stats_frame;       // when those were worked out
+
+    float latency_s [History];  // input to present; a ring
+    int latency_count;
+
+    // For the CSV.
+    ProfFrame ring [RingSize];
+    std::atomic<uint64_t> written; // by the main thread
+    std::atomic<uint64_t> read;    // by the writer
+    std::atomic<bool> quit;
+    uint64_t dropped;
+    bool lossless;
+    FILE * csv;
+    std::thread writer;
+};
+
+static inline void
+Profiler_WriterMain (FrameProfiler * prof) {
+    for (;;) {
+        bool const quit = prof->quit.load(std::memory_order_acquire);
+        uint64_t const end = prof->written.load(std::memory_order_acquire);
+        uint64_t i = prof->read.load(std::memory_order_relaxed);
+        for (; i < end; ++i) {
+            ProfFrame const & f = prof->ring[i % FrameProfiler::RingSize];
+            float total = 0.0f;
+            ::fprintf(prof->csv, "%llu", (unsigned long long)f.index);
+            for (float s : f.phase_s) {
+                ::fprintf(prof->csv, ",%.4f", s * 1e3);
+                total += s;
+            }
+            ::fprintf(prof->csv, ",%.4f\n", total * 1e3);
+        }
+        prof->read.store(i, std::memory_order_release);
+        if (quit)
+            break;
+        if (prof->written.load(std::memory_order_acquire) == i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+}
+
+// "csv_path" may be null; then nothing's written out.
+static inline bool
+Profiler_Init (FrameProfiler * prof, char const * csv_path, bool lossless = false) {
+    prof->inv_freq = 1.0 / double(SDL_GetPerformanceFrequency());
+    prof->mark = SDL_GetPerformanceCounter();
+    prof->current = {};
+    prof->frame_count = 0;
+    prof->started = false;
+    prof->trace_mark = 0;
+    prof->stats_frame = 0;
+    prof->latency_count = 0;
+    std::fill(prof->stats, prof->stats + Prof_PhaseCount + 1, ProfStats{});
+    prof->written = 0;
+    prof->read = 0;
+    prof->quit = false;
+    prof->dropped = 0;
+    prof->lossless = lossless;
+    prof->csv = nullptr;
+    if (csv_path) {
+        prof->csv = ::fopen(csv_path, "w");
+        if (!prof->csv)
+            return false;
+        ::fprintf(prof->csv, "frame");
+        for (char const * name : g_prof_phase_names)
+            ::fprintf(prof->csv, ",%s_ms", name);
+        ::fprintf(prof->csv, ",total_ms\n");
+        prof->writer = std::thread (Profiler_WriterMain, prof);
+    }
+    return true;
+}
+
+// Writes out whatever's left; returns the number of frames that didn't
+// make it into the CSV.
+static inline uint64_t
+Profiler_Close (FrameProfiler * prof) {
+    if (prof->csv) {
+        prof->quit.store(true, std::memory_order_release);
+        prof->writer.join();
+        ::fclose(prof->csv);
+        prof->csv = nullptr;
+    }
+    return prof->dropped;
+}
+
+// The phase that just ended; the next one starts now.
+inline void Profiler_Mark (FrameProfiler * prof, ProfPhase phase) {
+    uint64_t const now = SDL_GetPerformanceCounter();
+    prof->current.phase_s[phase] += float(double(now - prof->mark) * prof->inv_freq);
+    prof->mark = now;
+#if defined(BO_TRACE) && BO_TRACE > 0
+    if (Trace_IsOn()) {
+        uint64_t const trace_now = Trace_Now();
+        if (prof->trace_mark)
+            Trace_Span(g_prof_phase_names[phase], prof->trace_mark, trace_now);
+        prof->trace_mark = trace_now;
+    } else {
+        prof->trace_mark = 0;
+    }
+#endif
+}
+
+// Wraps up the frame that's been marked so far, and starts the next one.
+static inline void
+Profiler_NextFrame (FrameProfiler * prof) {
+    if (!prof->started) {
+        // Nothing before the first frame counts.
+        prof->started = true;
+        prof->mark = SDL_GetPerformanceCounter();
+        return;
+    }
+    ProfFrame const & f = prof->current;
+    prof->history[prof->frame_count % FrameProfiler::History] = f;
+    prof->frame_count += 1;
+
+    if (prof->csv) {
+        uint64_t const w = prof->written.load(std::memory_order_relaxed);
+        while (prof->lossless && w - prof->read.load(std::memory_order_acquire) >= FrameProfiler::RingSize)
+            std::this_thread::yield();
+        if (w - prof->read.load(std::memory_order_acquire) < FrameProfiler::RingSize) {
+            prof->ring[w % FrameProfiler::RingSize] = f;
+            prof->written.store(w + 1, std::memory_order_release);
+        } else {
+            prof->dropped += 1;
+        }
+    }
+
+    prof->current = {};
+    prof->current.index = prof->frame_count;
+}
+
+static inline void
+Profiler_AddLatency (FrameProfiler * prof, double latency_s) {
+    prof->latency_s[prof->latency_count++ % FrameProfiler::History] = float(latency_s);
+}
+
+// Of the recent inputs.
+static inline ProfStats
+Profiler_LatencyStats (FrameProfiler const * prof) {
+    int const n = std::min(prof->latency_count, int(FrameProfiler::History));
+    if (n <= 0)
+        return {};
+    float values [FrameProfiler::History];
+    std::copy(prof->latency_s, prof->latency_s + n, values);
+    std::sort(values, values + n);
+    auto at = [&](double q){return values[std::min(n - 1, int(q * n))];};
+    return {at(0.50), at(0.95), at(0.99), values[n - 1]};
+}
+
+// Percentiles of each phase (and the whole frame) over the recent frames.
+static inline void
+Profiler_UpdateStats (FrameProfiler * prof) {
+    int const n = int(std::min<uint64_t>(prof->frame_count, FrameProfiler::History));
+    prof->stats_frame = prof->frame_count;
+    if (n <= 0)
+        return;
+    float values [FrameProfiler::History];
+    for (int p = 0; p <= Prof_PhaseCount; ++p) {
+        for (int i = 0; i < n; ++i) {
+            ProfFrame const & f = prof->history[i];
+            if (p < Prof_PhaseCount) {
+                values[i] = f.phase_s[p];
+            } else {
+                values[i] = 0.0f;
+                for (float s : f.phase_s)
+                    values[i] += s;
+            }
+        }
+        std::sort(values, values + n);
+        auto at = [&](double q){return values[std::min(n - 1, int(q * n))];};
+        prof->stats[p] = {at(0.50), at(0.95), at(0.99), values[n - 1]};
+    }
+}
+
+static inline void
+Profiler_Print (FrameProfiler * prof, FILE * out) {
+    Profiler_UpdateStats(prof);
+    ::fprintf(out, "%-8s %9s %9s %9s %9s   (ms, over the last %d frames)\n",
+        "phase", "p50", "p95", "p99", "max", int(std::min<uint64_t>(prof->frame_count, FrameProfiler::History)));
+    for (int p = 0; p <= Prof_PhaseCount; ++p) {
+        ProfStats const & s = prof->stats[p];
+        ::fprintf(out, "%-8s %9.3f %9.3f %9.3f %9.3f\n",
+            p < Prof_PhaseCount ? g_prof_phase_names[p] : "frame", s.p50 * 1e3, s.p95 * 1e3, s.p99 * 1e3, s.max * 1e3);
+    }
+    if (prof->latency_count > 0) {
+        ProfStats const s = Profiler_LatencyStats(prof);
+        ::fprintf(out, "%-8s %9.3f %9.3f %9.3f %9.3f   (input to present, over the last %d inputs)\n",
+            "latency", s.p50 * 1e3, s.p95 * 1e3, s.p99 * 1e3, s.max * 1e3, std::min(prof->latency_count, int(FrameProfiler::History)));
+    }
+}
+
+//----------------------------------------------------------------------
+// The overlay: there's no font, so it's a row of bars per phase, in the
+// order of the names above, with the whole frame at the bottom. A bar's
+// solid part is the median, and it goes on, dimmer and dimmer, to the
+// 95th and the 99th percentiles; a tick marks the worst. The white line
+// is the frame budget.
+
+constexpr int ProfOverlayRow = 6;
+constexpr int ProfOverlayWidth = 240;
+constexpr int ProfOverlayHeight = ProfOverlayRow * (Prof_PhaseCount + 1) + 4;
+constexpr int ProfOverlayCommands = 1 + 4 * (Prof_PhaseCount + 1) + 1;  // at most, per Profiler_DrawOverlay()
+
+inline Rect Profiler_OverlayRect (int x, int y) {return Rect_OfAAB(x, y, ProfOverlayWidth, ProfOverlayHeight);}
+
+static inline void
+Profiler_DrawOverlay (FrameProfiler * prof, DrawList * list, int x, int y, double budget_s) {
+    if (prof->frame_count - prof->stats_frame >= 30 || 0 == prof->stats_frame)
+        Profiler_UpdateStats(prof);     // a few times a second is plenty
+
+    static Color const colors [Prof_PhaseCount + 1] = {
+        {200, 200, 200}, {120, 200, 255}, {255, 200, 60}, {80, 80, 255}, {255, 120, 200},
+        {255, 60, 60}, {60, 255, 200}, {180, 120, 255}, {100, 100, 100}, {255, 255, 255},
+    };
+    int const budget_px = 160;
+    double const px_per_s = budget_px / budget_s;
+    auto px = [&](float s){return Min(int(s * px_per_s + 0.5), ProfOverlayWidth - 4);};
+
+    Rect const r = Profiler_OverlayRect(x, y);
+    DrawList_AAB(list, r, {0, 0, 0, 160}, BlendMode::Over);
+    for (int p = 0; p <= Prof_PhaseCount; ++p) {
+        ProfStats const & s = prof->stats[p];
+        Color const c = colors[p];
+        Color const dim = {byte(c.r / 2), byte(c.g / 2), byte(c.b / 2)};
+        Color const dimmer = {byte(c.r / 4), byte(c.g / 4), byte(c.b / 4)};
+        int const ry = y + 2 + p * ProfOverlayRow, rh = ProfOverlayRow - 2;
+        int const x50 = px(s.p50), x95 = Max(px(s.p95), x50), x99 = Max(px(s.p99), x95);
+        if (x99 > x95)
+            DrawList_AAB(list, x + 2 + x95, ry, x99 - x95, rh, dimmer);
+        if (x95 > x50)
+            DrawList_AAB(list, x + 2 + x50, ry, x95 - x50, rh, dim);
+        if (x50 > 0)
+            DrawList_AAB(list, x + 2, ry, x50, rh, c);
+        DrawList_AAB(list, x + 2 + px(s.max), ry, 1, rh, c);
+    }
+    DrawList_AAB(list, x + 2 + budget_px, y, 1, r.y1 - r.y0, {255, 255, 255});
+}
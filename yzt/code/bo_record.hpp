@@ -0,0 +1,379 @@
+#pragma once
+
+#include "bo_common.hpp"
+#include "bo_sim.hpp"
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Recording what was fed into the simulation, and feeding it back in.
+// Since the simulation is deterministic, that's all it takes to get the
+// exact same sequence of states again, as fast as the machine can go.
+//
+// A log ("BORC") is a header with the SimConfig, then a stream of records,
+// each a tag byte and its payload:
+//
+//      Move    the new movement, as the float's 4 bytes
+//      Act     a flags byte (serve, split); with the current movement
+//      Ticks   a varint count of ticks run with the current movement
+//      End     varint total ticks, then the state hash after them
+//
+// Nothing's written while the input doesn't change; a game where the
+// paddle moves a few times a second comes to a few bytes a second.
+// Everything is little-endian; varints are LEB128.
+
+enum class RecordTag : byte {End, Move, Act, Ticks};
+
+constexpr uint32_t InputLogVersion = 1;
+
+inline void Record_PutVarint (std::vector<byte> * out, uint64_t v) {
+    for (; v >= 0x80; v >>= 7)
+        out->push_back(byte(v | 0x80));
+    out->push_back(byte(v));
+}
+
+inline void Record_PutU32 (std::vector<byte> * out, uint32_t v) {
+    byte const b [4] = {byte(v), byte(v >> 8), byte(v >> 16), byte(v >> 24)};
+    out->insert(out->end(), b, b + 4);
+}
+
+inline void Record_PutFloat (std::vector<byte> * out, float v) {
+    uint32_t bits;
+    ::memcpy(&bits, &v, 4);
+    Record_PutU32(out, bits);
+}
+
+inline void Record_PutU64 (std::vector<byte> * out, uint64_t v) {
+    Record_PutU32(out, uint32_t(v));
+    Record_PutU32(out, uint32_t(v >> 32));
+}
+
+// Reading goes through a cursor that just stops (and stays stopped) at
+// the end of the data or at anything malformed.
+struct RecordReader {
+    byte const * p;
+    byte const * end;
+    bool ok;
+};
+
+inline bool Record_GetVarint (RecordReader * r, uint64_t * v) {
+    *v = 0;
+    for (int shift = 0; r->ok && r->p < r->end && shift < 64; shift += 7) {
+        byte const b = *r->p++;
+        *v |= uint64_t(b & 0x7F) << shift;
+        if (0 == (b & 0x80))
+            return true;
+    }
+    return r->ok = false;
+}
+
+inline bool Record_GetU32 (RecordReader * r, uint32_t * v) {
+    if (!r->ok || r->end - r->p < 4)
+        return r->ok = false;
+    *v = uint32_t(r->p[0]) | (uint32_t(r->p[1]) << 8) | (uint32_t(r->p[2]) << 16) | (uint32_t(r->p[3]) << 24);
+    r->p += 4;
+    return true;
+}
+
+inline bool Record_GetFloat (RecordReader * r, float * v) {
+    uint32_t bits = 0;
+    if (!Record_GetU32(r, &bits))
+        return false;
+    ::memcpy(v, &bits, 4);
+    return true;
+}
+
+inline bool Record_GetU64 (RecordReader * r, uint64_t * v) {
+    uint32_t lo = 0, hi = 0;
+    if (!Record_GetU32(r, &lo) || !Record_GetU32(r, &hi))
+        return false;
+    *v = uint64_t(lo) | (uint64_t(hi) << 32);
+    return true;
+}
+
+// Every field, in order; the same code both ways so they can't drift apart.
+template <typename F>
+static inline void
+Record_ForEachConfigField (SimConfig & c, F && f) {
+    int * const ints [] = {&c.tick_hz, &c.serve_balls, &c.balls_per_job, &c.max_impacts_per_tick, &c.width, &c.height};
+    float * const floats [] = {
+        &c.paddle_speed, &c.paddle_vert_pos, &c.paddle_half_dims.x, &c.paddle_half_dims.y,
+        &c.ball_radius, &c.ball_speed, &c.brick_half_dims.x, &c.brick_half_dims.y,
+    };
+    for (int * v : ints)
+        f(v, (float *)nullptr);
+    for (float * v : floats)
+        f((int *)nullptr, v);
+    uint32_t color = uint32_t(c.brick_color.r) | (uint32_t(c.brick_color.g) << 8) | (uint32_t(c.brick_color.b) << 16) | (uint32_t(c.brick_color.a) << 24);
+    int color_int = int(color);
+    f(&color_int, (float *)nullptr);
+    color = uint32_t(color_int);
+    c.brick_color = {byte(color), byte(color >> 8), byte(color >> 16), byte(color >> 24)};
+}
+
+//----------------------------------------------------------------------
+
+// The file is written on a thread of its own, so a slow disk never holds
+// up a frame; the game only ever appends to a memory buffer, and hands it
+// over now and then.
+struct InputRecorder {
+    static constexpr size_t HandOverSize = 16 * 1024;
+
+    FILE * file;
+    std::vector<byte> buffer;       // the game's side
+
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<byte> pending;      // handed over, not yet written
+    bool quit;
+    bool failed;                    // the writer couldn't write
+
+    float movement;
+    uint64_t run;                   // ticks since the last record, not yet written
+    uint64_t ticks;
+};
+
+static inline void
+InputRecorder_WriterMain (InputRecorder * rec) {
+    std::vector<byte> chunk;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock (rec->mutex);
+            rec->wake.wait(lock, [&]{return rec->quit || !rec->pending.empty();});
+            if (rec->pending.empty())
+                return;     // quitting, and nothing left
+            chunk.swap(rec->pending);
+        }
+        if (chunk.size() != ::fwrite(chunk.data(), 1, chunk.size(), rec->file))
+            rec->failed = true;
+        chunk.clear();
+    }
+}
+
+static inline void
+InputRecorder_HandOver (InputRecorder * rec) {
+    if (rec->buffer.empty())
+        return;
+    {
+        std::lock_guard<std::mutex> lock (rec->mutex);
+        rec->pending.insert(rec->pending.end(), rec->buffer.begin(), rec->buffer.end());
+    }
+    rec->wake.notify_one();
+    rec->buffer.clear();
+}
+
+static inline void
+InputRecorder_FlushRun (InputRecorder * rec) {
+    if (rec->run > 0) {
+        rec->buffer.push_back(byte(RecordTag::Ticks));
+        Record_PutVarint(&rec->buffer, rec->run);
+        rec->run = 0;
+    }
+}
+
+static inline void
+InputRecorder_SetMovement (InputRecorder * rec, float movement) {
+    if (::memcmp(&movement, &rec->movement, sizeof(float)) != 0) {
+        InputRecorder_FlushRun(rec);
+        rec->buffer.push_back(byte(RecordTag::Move));
+        Record_PutFloat(&rec->buffer, movement);
+        rec->movement = movement;
+    }
+}
+
+// Start recording a game that's about to start with "config".
+static inline bool
+InputRecorder_Open (InputRecorder * rec, char const * path, SimConfig const & config) {
+    rec->file = ::fopen(path, "wb");
+    if (!rec->file)
+        return false;
+    rec->buffer.clear();
+    rec->pending.clear();
+    rec->quit = false;
+    rec->failed = false;
+    rec->movement = 0.0f;
+    rec->run = 0;
+    rec->ticks = 0;
+
+    byte const magic [4] = {'B', 'O', 'R', 'C'};
+    rec->buffer.insert(rec->buffer.end(), magic, magic + 4);
+    Record_PutU32(&rec->buffer, InputLogVersion);
+    SimConfig c = config;
+    Record_ForEachConfigField(c, [&](int * i, float * f){
+        if (i)
+            Record_PutU32(&rec->buffer, uint32_t(*i));
+        else
+            Record_PutFloat(&rec->buffer, *f);
+    });
+    rec->writer = std::thread(InputRecorder_WriterMain, rec);
+    return true;
+}
+
+// Call these right along with Sim_Act() and Sim_Tick().
+static inline void
+InputRecorder_Act (InputRecorder * rec, SimInput const & input) {
+    if (!input.serve && !input.split_balls)
+        return;     // Sim_Act() wouldn't do anything
+    InputRecorder_SetMovement(rec, input.movement);
+    InputRecorder_FlushRun(rec);
+    rec->buffer.push_back(byte(RecordTag::Act));
+    rec->buffer.push_back(byte((input.serve ? 1 : 0) | (input.split_balls ? 2 : 0)));
+}
+
+static inline void
+InputRecorder_Tick (InputRecorder * rec, SimInput const & input) {
+    InputRecorder_SetMovement(rec, input.movement);
+    rec->run += 1;
+    rec->ticks += 1;
+    if (rec->buffer.size() >= InputRecorder::HandOverSize)
+        InputRecorder_HandOver(rec);
+}
+
+// Ends the log with where "sim" got to, and waits for it all to be written.
+static inline bool
+InputRecorder_Close (InputRecorder * rec, Sim const * sim) {
+    InputRecorder_FlushRun(rec);
+    rec->buffer.push_back(byte(RecordTag::End));
+    Record_PutVarint(&rec->buffer, rec->ticks);
+    Record_PutU64(&rec->buffer, Sim_Hash(sim));
+    InputRecorder_HandOver(rec);
+    {
+        std::lock_guard<std::mutex> lock (rec->mutex);
+        rec->quit = true;
+    }
+    rec->wake.notify_one();
+    rec->writer.join();
+    bool const ok = !rec->failed && 0 == ::fclose(rec->file);
+    rec->file = nullptr;
+    return ok;
+}
+
+// Whether a config read from a log is one the sim can run at all; the
+// sim divides by some of these and sizes things by others.
+static inline bool
+Record_ConfigIsValid (SimConfig const & c) {
+    auto positive = [](float v){return std::isfinite(v) && v > 0.0f;};
+    return c.tick_hz >= 1 && c.serve_balls >= 1 && c.balls_per_job >= 1 && c.max_impacts_per_tick >= 1
+        && c.width > 0 && c.height > 0
+        && positive(c.paddle_speed) && std::isfinite(c.paddle_vert_pos)
+        && positive(c.paddle_half_dims.x) && positive(c.paddle_half_dims.y)
+        && positive(c.ball_radius) && positive(c.ball_speed)
+        && positive(c.brick_half_dims.x) && positive(c.brick_half_dims.y);
+}
+
+//----------------------------------------------------------------------
+
+// The whole log is read in up front; even hours of play are small.
+struct InputReplay {
+    std::vector<byte> data;
+    RecordReader reader;
+    SimConfig config;
+
+    float movement;
+    uint64_t run;                   // ticks left in the current run
+    bool ended;                     // got to the End record
+    uint64_t end_ticks;
+    uint64_t end_hash;
+};
+
+static inline bool
+InputReplay_Open (InputReplay * replay, char const * path) {
+    FILE * f = ::fopen(path, "rb");
+    if (!f)
+        return false;
+    replay->data.clear();
+    byte chunk [64 * 1024];
+    for (size_t n; (n = ::fread(chunk, 1, sizeof(chunk), f)) > 0; )
+        replay->data.insert(replay->data.end(), chunk, chunk + n);
+    ::fclose(f);
+
+    RecordReader & r = replay->reader;
+    r = {replay->data.data(), replay->data.data() + replay->data.size(), true};
+    uint32_t version = 0;
+    r.ok = replay->data.size() >= 4 && 0 == ::memcmp(r.p, "BORC", 4);
+    if (r.ok)
+        r.p += 4;
+    Record_GetU32(&r, &version);
+    r.ok = r.ok && InputLogVersion == version;
+    replay->config = {};
+    Record_ForEachConfigField(replay->config, [&](int * i, float * v){
+        uint32_t u = 0;
+        if (i && Record_GetU32(&r, &u))
+            *i = int(u);
+        else if (v)
+            Record_GetFloat(&r, v);
+    });
+    r.ok = r.ok && Record_ConfigIsValid(replay->config);
+    replay->movement = 0.0f;
+    replay->run = 0;
+    replay->ended = false;
+    replay->end_ticks = replay->end_hash = 0;
+    return r.ok;
+}
+
+// Feeds the log into "sim" (which has to have been started with the log's
+// config) until it has run "until_tick" ticks, or the log runs out; in
+// which case it returns false. A log that was cut short (the game
+// crashed, say) plays as far as it goes.
+static inline bool
+InputReplay_Advance (InputReplay * replay, Sim * sim, uint64_t until_tick) {
+    RecordReader & r = replay->reader;
+    while (sim->ticks < until_tick) {
+        if (replay->run > 0) {
+            SimInput input;
+            input.movement = replay->movement;
+            for (; replay->run > 0 && sim->ticks < until_tick; --replay->run)
+                Sim_Tick(sim, input);
+            continue;
+        }
+        if (!r.ok || r.p >= r.end || replay->ended)
+            return false;
+        switch (RecordTag(*r.p++)) {
+        case RecordTag::Move:
+            Record_GetFloat(&r, &replay->movement);
+            break;
+        case RecordTag::Act: {
+            if (r.p >= r.end) {
+                r.ok = false;
+                break;
+            }
+            byte const flags = *r.p++;
+            SimInput input;
+            input.movement = replay->movement;
+            input.serve = 0 != (flags & 1);
+            input.split_balls = 0 != (flags & 2);
+            Sim_Act(sim, input);
+        } break;
+        case RecordTag::Ticks:
+            Record_GetVarint(&r, &replay->run);
+            break;
+        case RecordTag::End:
+            replay->ended = Record_GetVarint(&r, &replay->end_ticks) && Record_GetU64(&r, &replay->end_hash);
+            break;
+        default:
+            r.ok = false;
+        }
+    }
+    return true;
+}
+
+// Once a replay has run out: whether it ended where the recording did.
+// Prints the verdict.
+static inline bool
+InputReplay_Check (InputReplay const * replay, Sim const * sim) {
+    uint64_t const hash = Sim_Hash(sim);
+    if (!replay->ended) {
+        ::printf("replay: log ends early (%s) after %llu ticks; hash %016llx\n",
+            replay->reader.ok ? "cut short" : "malformed", (unsigned long long)sim->ticks, (unsigned long long)hash);
+        return false;
+    }
+    bool const same = replay->end_ticks == sim->ticks && replay->end_hash == hash;
+    ::printf("replay: %llu ticks, hash %016llx; recorded %llu ticks, hash %016llx  %s\n",
+        (unsigned long long)sim->ticks, (unsigned long long)hash,
+        (unsigned long long)replay->end_ticks, (unsigned long long)replay->end_hash,
+        same ? "MATCH" : "MISMATCH");
+    return same;
+}
@@ -1,43 +1,442 @@
 #pragma once
 
+#include "bo_common.hpp"
+#include "bo_math.hpp"
+#include "bo_platform.hpp"
+#include "bo_trace.hpp"
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+
 struct Color {
     byte b, g, r, a;
 
     Color (byte r_, byte g_, byte b_, byte a_ = 255) : r (r_), g (g_), b (b_), a (a_) {}
 };
 
+struct Rect {
+    int x0, y0, x1, y1;     // [x0, x1) x [y0, y1)
+};
+
+inline bool Rect_IsEmpty (Rect const & r) {return r.x1 <= r.x0 || r.y1 <= r.y0;}
+inline long long Rect_Area (Rect const & r) {return Rect_IsEmpty(r) ? 0 : (long long)(r.x1 - r.x0) * (r.y1 - r.y0);}
+inline Rect Rect_Intersect (Rect const & a, Rect const & b) {return {Max(a.x0, b.x0), Max(a.y0, b.y0), Min(a.x1, b.x1), Min(a.y1, b.y1)};}
+inline Rect Rect_Union (Rect const & a, Rect const & b) {return {Min(a.x0, b.x0), Min(a.y0, b.y0), Max(a.x1, b.x1), Max(a.y1, b.y1)};}
+inline bool Rect_Overlaps (Rect const & a, Rect const & b) {return !Rect_IsEmpty(Rect_Intersect(a, b));}
+inline bool Rect_Contains (Rect const & outer, Rect const & inner) {return outer.x0 <= inner.x0 && outer.y0 <= inner.y0 && inner.x1 <= outer.x1 && inner.y1 <= outer.y1;}
+
+// The pixels touched by Render_AAB() and Render_Circle() respectively.
+inline Rect Rect_OfAAB (int x0, int y0, int w, int h) {return {x0, y0, x0 + w, y0 + h};}
+inline Rect Rect_OfCircle (int x, int y, int r) {return {x - r, y - r, x + r + 1, y + r + 1};}
+
 struct Canvas {
     void * pixels_raw;
     int pitch_bytes;
     int width, height;
+    Rect clip;              // nothing outside this is ever written
 
     Color * pixel(int x, int y) {return (Color *)((byte *)pixels_raw + y * (size_t)pitch_bytes + x * sizeof(Color));}
+    Color const * pixel(int x, int y) const {return (Color const *)((byte const *)pixels_raw + y * (size_t)pitch_bytes + x * sizeof(Color));}
+};
+
+inline Rect Canvas_Bounds (Canvas const * canvas) {return {0, 0, canvas->width, canvas->height};}
+inline void Canvas_SetClip (Canvas * canvas, Rect const & r) {canvas->clip = Rect_Intersect(r, Canvas_Bounds(canvas));}
+inline void Canvas_ResetClip (Canvas * canvas) {canvas->clip = Canvas_Bounds(canvas);}
+
+// A canvas over memory somebody else owns (e.g. a locked SDL texture.)
+inline Canvas Canvas_Wrap (void * pixels, int pitch_bytes, int width, int height) {
+    Canvas ret = {};
+    ret.pixels_raw = pixels;
+    ret.pitch_bytes = pitch_bytes;
+    ret.width = width;
+    ret.height = height;
+    Canvas_ResetClip(&ret);
+    return ret;
+}
+
+// A canvas that owns its pixels; rows are cache-line aligned. Release
+// with Canvas_Free().
+inline Canvas Canvas_Alloc (int width, int height) {
+    int const pitch_bytes = (width * int(sizeof(Color)) + 63) & ~63;
+    void * pixels = Mem_AllocAligned(size_t(pitch_bytes) * height, 64);
+    ASSERT(pixels);
+    return Canvas_Wrap(pixels, pitch_bytes, width, height);
+}
+
+inline void Canvas_Free (Canvas * canvas) {
+    Mem_FreeAligned(canvas->pixels_raw);
+    *canvas = {};
+}
+
+// FNV-1a over every visible pixel, row by row; the pitch padding isn't
+// part of it, so the same picture hashes the same in any canvas.
+static inline uint64_t
+Canvas_Hash (Canvas const * canvas) {
+    uint64_t h = 1469598103934665603ull;
+    for (int y = 0; y < canvas->height; ++y) {
+        uint32_t const * p = (uint32_t const *)canvas->pixel(0, y);
+        for (int x = 0; x < canvas->width; ++x) {
+            h ^= p[x];
+            h *= 1099511628211ull;
+        }
+    }
+    return h;
+}
+
+// Binary PPM (P6); alpha is dropped.
+static inline bool
+Canvas_SavePPM (Canvas const * canvas, char const * path) {
+    FILE * f = ::fopen(path, "wb");
+    if (!f)
+        return false;
+    ::fprintf(f, "P6\n%d %d\n255\n", canvas->width, canvas->height);
+    std::vector<byte> row (size_t(canvas->width) * 3);
+    for (int y = 0; y < canvas->height; ++y) {
+        Color const * p = canvas->pixel(0, y);
+        for (int x = 0; x < canvas->width; ++x) {
+            row[3 * x + 0] = p[x].r;
+            row[3 * x + 1] = p[x].g;
+            row[3 * x + 2] = p[x].b;
+        }
+        ::fwrite(row.data(), 1, row.size(), f);
+    }
+    bool const ok = !::ferror(f);
+    ::fclose(f);
+    return ok;
+}
+
+//----------------------------------------------------------------------
+// Span fills. Every horizontal run of pixels ends up in one of these;
+// Render_Init() picks the widest kernel the CPU supports.
+
+using FillSpanFunc = void (*) (Color * dst, int count, Color c);
+
+struct FillKernel {
+    char const * name;
+    FillSpanFunc func;
+};
+
+inline uint32_t Color_Bits (Color c) {
+    uint32_t ret;
+    ::memcpy(&ret, &c, sizeof(ret));
+    return ret;
+}
+
+static void
+Fill_Span_Scalar (Color * dst, int count, Color c) {
+    for (; count >= 4; count -= 4, dst += 4) {
+        dst[0] = c; dst[1] = c; dst[2] = c; dst[3] = c;
+    }
+    for (; count > 0; --count, ++dst)
+        *dst = c;
+}
+
+#if defined(BO_ARCH_X86)
+// Both x86 kernels write the first and last vector unaligned (overlapping
+// the body) and everything in between aligned. That only works when the
+// span starts on a pixel boundary, which is the case for any sane pitch.
+static BO_TARGET_SSE2 void
+Fill_Span_SSE2 (Color * dst, int count, Color c) {
+    if (count < 4 || (uintptr_t(dst) & 3)) {
+        Fill_Span_Scalar(dst, count, c);
+        return;
+    }
+    __m128i const v = _mm_set1_epi32(int(Color_Bits(c)));
+    Color * const end = dst + count;
+    _mm_storeu_si128((__m128i *)dst, v);
+    Color * p = (Color *)((uintptr_t(dst) + 16) & ~uintptr_t(15));
+    for (; p + 16 <= end; p += 16) {
+        _mm_store_si128((__m128i *)p + 0, v);
+        _mm_store_si128((__m128i *)p + 1, v);
+        _mm_store_si128((__m128i *)p + 2, v);
+        _mm_store_si128((__m128i *)p + 3, v);
+    }
+    for (; p + 4 <= end; p += 4)
+        _mm_store_si128((__m128i *)p, v);
+    _mm_storeu_si128((__m128i *)(end - 4), v);
+}
+
+static BO_TARGET_AVX2 void
+Fill_Span_AVX2 (Color * dst, int count, Color c) {
+    if (count < 8 || (uintptr_t(dst) & 3)) {
+        Fill_Span_Scalar(dst, count, c);
+        return;
+    }
+    __m256i const v = _mm256_set1_epi32(int(Color_Bits(c)));
+    Color * const end = dst + count;
+    _mm256_storeu_si256((__m256i *)dst, v);
+    Color * p = (Color *)((uintptr_t(dst) + 32) & ~uintptr_t(31));
+    for (; p + 32 <= end; p += 32) {
+        _mm256_store_si256((__m256i *)p + 0, v);
+        _mm256_store_si256((__m256i *)p + 1, v);
+        _mm256_store_si256((__m256i *)p + 2, v);
+        _mm256_store_si256((__m256i *)p + 3, v);
+    }
+    for (; p + 8 <= end; p += 8)
+        _mm256_store_si256((__m256i *)p, v);
+    _mm256_storeu_si256((__m256i *)(end - 8), v);
+}
+#endif
+
+#if defined(BO_ARCH_NEON)
+static void
+Fill_Span_NEON (Color * dst, int count, Color c) {
+    uint32x4_t const v = vdupq_n_u32(Color_Bits(c));
+    for (; count >= 16; count -= 16, dst += 16) {
+        vst1q_u32((uint32_t *)dst + 0, v);
+        vst1q_u32((uint32_t *)dst + 4, v);
+        vst1q_u32((uint32_t *)dst + 8, v);
+        vst1q_u32((uint32_t *)dst + 12, v);
+    }
+    for (; count >= 4; count -= 4, dst += 4)
+        vst1q_u32((uint32_t *)dst, v);
+    Fill_Span_Scalar(dst, count, c);
+}
+#endif
+
+// Fills "out" with the kernels this CPU can run, narrowest first.
+static int
+Render_AvailableFillKernels (FillKernel * out, int max_count) {
+    int n = 0;
+    if (n < max_count) out[n++] = {"scalar", Fill_Span_Scalar};
+#if defined(BO_ARCH_X86)
+    if (n < max_count && Platform_HasSSE2()) out[n++] = {"sse2", Fill_Span_SSE2};
+    if (n < max_count && Platform_HasAVX2()) out[n++] = {"avx2", Fill_Span_AVX2};
+#endif
+#if defined(BO_ARCH_NEON)
+    if (n < max_count && Platform_HasNEON()) out[n++] = {"neon", Fill_Span_NEON};
+#endif
+    return n;
+}
+
+inline FillKernel g_fill_kernel = {"scalar", Fill_Span_Scalar};
+
+static inline void
+Render_FillSpan (Color * dst, int count, Color c) {
+    if (count < 8) {
+        for (; count > 0; --count, ++dst)
+            *dst = c;
+    } else {
+        g_fill_kernel.func(dst, count, c);
+    }
+}
+
+//----------------------------------------------------------------------
+// Blending. The source alpha is the weight, and the destination's alpha
+// channel is blended like the others with a source value of 255, which
+// makes Over come out as the usual a + d.a * (1 - a).
+//   Over:      d = (s * a + d * (255 - a)) / 255
+//   Add:       d = min(255, d + s * a / 255)
+//   Multiply:  d = d * lerp(255, s, a) / 255
+// Every division rounds to nearest. All kernels do exactly the same
+// 16-bit integer math, so they all give identical results; each is
+// specialised per mode at compile time.
+
+enum class BlendMode : uint8_t {
+    Opaque,
+    Over,
+    Add,
+    Multiply,
+};
+
+struct BlendParams {
+    uint16_t mul [4];       // per channel, in memory (b, g, r, a) order
+    uint16_t add [4];       // (for Over and Multiply, includes the rounding term)
+};
+
+inline int Div255 (int x) {int t = x + 128; return (t + (t >> 8)) >> 8;}  // exact for x in [0, 255 * 255]
+
+static inline BlendParams
+Blend_Prepare (Color c, BlendMode mode) {
+    BlendParams ret = {};
+    int const a = c.a;
+    int const s [4] = {c.b, c.g, c.r, 255};
+    for (int ch = 0; ch < 4; ++ch) {
+        switch (mode) {
+        case BlendMode::Opaque:
+        case BlendMode::Over: ret.mul[ch] = uint16_t(255 - a); ret.add[ch] = uint16_t(s[ch] * a + 128); break;
+        case BlendMode::Add: ret.mul[ch] = 0; ret.add[ch] = uint16_t(Div255(s[ch] * a)); break;
+        case BlendMode::Multiply: ret.mul[ch] = uint16_t(Div255(s[ch] * a + 255 * (255 - a))); ret.add[ch] = 128; break;
+        }
+    }
+    return ret;
+}
+
+using BlendSpanFunc = void (*) (Color * dst, int count, BlendParams const & p);
+
+struct BlendKernel {
+    char const * name;
+    BlendSpanFunc funcs [4];    // indexed by BlendMode; nothing for Opaque
 };
 
+template <BlendMode Mode>
+static void
+Blend_Span_Scalar (Color * dst, int count, BlendParams const & p) {
+    byte * d = (byte *)dst;
+    for (; count > 0; --count, d += 4) {
+        for (int ch = 0; ch < 4; ++ch) {
+            if constexpr (BlendMode::Add == Mode) {
+                d[ch] = byte(Min(255, d[ch] + p.add[ch]));
+            } else {
+                int t = d[ch] * p.mul[ch] + p.add[ch];
+                d[ch] = byte((t + (t >> 8)) >> 8);
+            }
+        }
+    }
+}
+
+#if defined(BO_ARCH_X86)
+template <BlendMode Mode>
+static BO_TARGET_SSE2 void
+Blend_Span_SSE2 (Color * dst, int count, BlendParams const & p) {
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const mul = _mm_set_epi16(
+        short(p.mul[3]), short(p.mul[2]), short(p.mul[1]), short(p.mul[0]),
+        short(p.mul[3]), short(p.mul[2]), short(p.mul[1]), short(p.mul[0]));
+    __m128i const add = _mm_set_epi16(
+        short(p.add[3]), short(p.add[2]), short(p.add[1]), short(p.add[0]),
+        short(p.add[3]), short(p.add[2]), short(p.add[1]), short(p.add[0]));
+    __m128i const add8 = _mm_set1_epi32(int(p.add[0] | (p.add[1] << 8) | (p.add[2] << 16) | (uint32_t(p.add[3]) << 24)));
+    for (; count >= 4; count -= 4, dst += 4) {
+        __m128i v = _mm_loadu_si128((__m128i const *)dst);
+        if constexpr (BlendMode::Add == Mode) {
+            v = _mm_adds_epu8(v, add8);
+        } else {
+            __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), mul), add);
+            __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), mul), add);
+            lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+            hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+            v = _mm_packus_epi16(lo, hi);
+        }
+        _mm_storeu_si128((__m128i *)dst, v);
+    }
+    Blend_Span_Scalar<Mode>(dst, count, p);
+}
+
+// Unpacking and packing both work within 128-bit halves, and every pixel
+// uses the same constants, so this is the SSE2 kernel twice over.
+template <BlendMode Mode>
+static BO_TARGET_AVX2 void
+Blend_Span_AVX2 (Color * dst, int count, BlendParams const & p) {
+    __m256i const zero = _mm256_setzero_si256();
+    __m256i const mul = _mm256_set_epi16(
+        short(p.mul[3]), short(p.mul[2]), short(p.mul[1]), short(p.mul[0]),
+        short(p.mul[3]), short(p.mul[2]), short(p.mul[1]), short(p.mul[0]),
+        short(p.mul[3]), short(p.mul[2]), short(p.mul[1]), short(p.mul[0]),
+        short(p.mul[3]), short(p.mul[2]), short(p.mul[1]), short(p.mul[0]));
+    __m256i const add = _mm256_set_epi16(
+        short(p.add[3]), short(p.add[2]), short(p.add[1]), short(p.add[0]),
+        short(p.add[3]), short(p.add[2]), short(p.add[1]), short(p.add[0]),
+        short(p.add[3]), short(p.add[2]), short(p.add[1]), short(p.add[0]),
+        short(p.add[3]), short(p.add[2]), short(p.add[1]), short(p.add[0]));
+    __m256i const add8 = _mm256_set1_epi32(int(p.add[0] | (p.add[1] << 8) | (p.add[2] << 16) | (uint32_t(p.add[3]) << 24)));
+    for (; count >= 8; count -= 8, dst += 8) {
+        __m256i v = _mm256_loadu_si256((__m256i const *)dst);
+        if constexpr (BlendMode::Add == Mode) {
+            v = _mm256_adds_epu8(v, add8);
+        } else {
+            __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(v, zero), mul), add);
+            __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(v, zero), mul), add);
+            lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+            hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+            v = _mm256_packus_epi16(lo, hi);
+        }
+        _mm256_storeu_si256((__m256i *)dst, v);
+    }
+    Blend_Span_Scalar<Mode>(dst, count, p);
+}
+#endif
+
+static int
+Render_AvailableBlendKernels (BlendKernel * out, int max_count) {
+    int n = 0;
+    if (n < max_count) out[n++] = {"scalar", {nullptr,
+        Blend_Span_Scalar<BlendMode::Over>, Blend_Span_Scalar<BlendMode::Add>, Blend_Span_Scalar<BlendMode::Multiply>}};
+#if defined(BO_ARCH_X86)
+    if (n < max_count && Platform_HasSSE2()) out[n++] = {"sse2", {nullptr,
+        Blend_Span_SSE2<BlendMode::Over>, Blend_Span_SSE2<BlendMode::Add>, Blend_Span_SSE2<BlendMode::Multiply>}};
+    if (n < max_count && Platform_HasAVX2()) out[n++] = {"avx2", {nullptr,
+        Blend_Span_AVX2<BlendMode::Over>, Blend_Span_AVX2<BlendMode::Add>, Blend_Span_AVX2<BlendMode::Multiply>}};
+#endif
+    return n;
+}
+
+inline BlendKernel g_blend_kernel = {"scalar", {nullptr,
+    Blend_Span_Scalar<BlendMode::Over>, Blend_Span_Scalar<BlendMode::Add>, Blend_Span_Scalar<BlendMode::Multiply>}};
+
+static inline void
+Render_Init () {
+    FillKernel kernels [8];
+    int n = Render_AvailableFillKernels(kernels, 8);
+    g_fill_kernel = kernels[n - 1];
+
+    BlendKernel blend_kernels [8];
+    n = Render_AvailableBlendKernels(blend_kernels, 8);
+    g_blend_kernel = blend_kernels[n - 1];
+}
+
+//----------------------------------------------------------------------
+// The span primitives are written once against a "span op" and
+// instantiated for plain fills and for each kind of blend, so opaque
+// drawing is exactly as cheap as it was before blending existed.
+
+struct SpanFill {
+    Color c;
+    void operator () (Color * dst, int count) const {Render_FillSpan(dst, count, c);}
+};
+
+struct SpanBlend {
+    BlendSpanFunc func;
+    BlendParams params;
+    void operator () (Color * dst, int count) const {func(dst, count, params);}
+};
+
+// Calls draw(span_op) with the cheapest op for (c, mode), or not at all if
+// the result would be invisible.
+template <typename F>
+static inline void
+Render_WithSpanOp (Color c, BlendMode mode, F && draw) {
+    if (BlendMode::Opaque == mode || (BlendMode::Over == mode && 255 == c.a))
+        draw(SpanFill{c});
+    else if (0 != c.a)
+        draw(SpanBlend{g_blend_kernel.funcs[int(mode)], Blend_Prepare(c, mode)});
+}
+
+//----------------------------------------------------------------------
+
 static inline void
 Render_Pixel (Canvas * canvas, int x, int y, Color c) {
-    if (canvas && x >= 0 && y >= 0 && x < canvas->width && y < canvas->height)
+    if (canvas && x >= canvas->clip.x0 && y >= canvas->clip.y0 && x < canvas->clip.x1 && y < canvas->clip.y1)
         *canvas->pixel(x, y) = c;
 }
 
 static inline void
 Render_LineHoriz_Unchecked (Canvas * canvas, int x0, int x1, int y, Color c) {
-    Color * p = canvas->pixel(x0, y);
-    for (int i = x1 - x0; i >= 0; --i, ++p)
-        *p = c;
+    Render_FillSpan(canvas->pixel(x0, y), x1 - x0 + 1, c);
 }
 
+template <typename SpanOp>
 static inline void
-Render_LineHoriz (Canvas * canvas, int x0, int x1, int y, Color c) {
-    if (canvas && y >= 0 && y < canvas->height) {
+Render_LineHoriz_With (Canvas * canvas, int x0, int x1, int y, SpanOp const & span) {
+    if (canvas && y >= canvas->clip.y0 && y < canvas->clip.y1) {
         if (x1 < x0) {auto t = x0; x0 = x1; x1 = t;}
-        if (x0 < 0) x0 = 0;
-        if (x1 > canvas->width - 1) x1 = canvas->width - 1;
+        if (x0 < canvas->clip.x0) x0 = canvas->clip.x0;
+        if (x1 > canvas->clip.x1 - 1) x1 = canvas->clip.x1 - 1;
         if (x0 <= x1)
-            Render_LineHoriz_Unchecked(canvas, x0, x1, y, c);
+            span(canvas->pixel(x0, y), x1 - x0 + 1);
     }
 }
 
+static inline void
+Render_LineHoriz (Canvas * canvas, int x0, int x1, int y, Color c) {
+    Render_LineHoriz_With(canvas, x0, x1, y, SpanFill{c});
+}
+
+static inline void
+Render_LineHoriz (Canvas * canvas, int x0, int x1, int y, Color c, BlendMode mode) {
+    Render_WithSpanOp(c, mode, [&](auto const & span){Render_LineHoriz_With(canvas, x0, x1, y, span);});
+}
+
 static inline void
 Render_LineVert_Unchecked (Canvas * canvas, int x, int y0, int y1, Color c) {
     Color * p = canvas->pixel(x, y0);
@@ -48,109 +447,380 @@ Render_LineVert_Unchecked (Canvas * canvas, int x, int y0, int y1, Color c) {
 
 static inline void
 Render_LineVert (Canvas * canvas, int x, int y0, int y1, Color c) {
-    if (canvas && x >= 0 && x < canvas->width) {
+    if (canvas && x >= canvas->clip.x0 && x < canvas->clip.x1) {
         if (y1 < y0) {auto t = y0; y0 = y1; y1 = t;}
-        if (y0 < 0) y0 = 0;
-        if (y1 > canvas->height - 1) y1 = canvas->height - 1;
+        if (y0 < canvas->clip.y0) y0 = canvas->clip.y0;
+        if (y1 > canvas->clip.y1 - 1) y1 = canvas->clip.y1 - 1;
         if (y0 <= y1)
             Render_LineVert_Unchecked(canvas, x, y0, y1, c);
     }
 }
 
+//----------------------------------------------------------------------
+// Lines are all-integer Bresenham. For a line that takes "n" steps along
+// its major axis and "dm" (0 <= dm <= n) along its minor axis, pixel k
+// sits at minor offset floor((2k*dm + n) / 2n), i.e. the minor
+// coordinate rounded half-up. Clipping solves that for the first and last
+// k inside the clip rect, so the walk itself never checks anything, and
+// a clipped line has exactly the same pixels as the unclipped one (which
+// the tiled renderer relies on.) Coordinates are assumed to be within
+// +/-2^29, which keeps every product below in 64 bits.
+
+// The first k in [0, n] whose minor offset is at least "m" (n + 1 if none.)
+inline long long Line_FirstStepReaching (long long m, long long n, long long dm) {
+    if (m <= 0) return 0;
+    if (dm == 0) return n + 1;
+    return Min(n + 1, (2 * n * m - n + 2 * dm - 1) / (2 * dm));
+}
+
 static inline void
-Render_Line_XMajor_Unchecked (Canvas * canvas, int x0, int y0, int x1, int y1, Color c) {
-    ASSERT(x0 <= x1);
-    ASSERT(Abs(x1 - x0) >= Abs(y1 - y0));
+Render_Line_Walk (
+    Canvas * canvas, int x0, int y0, long long n, long long dm,
+    int major_lo, int major_hi, int minor_lo, int minor_hi,    // clip, relative to (x0, y0), along each axis
+    bool x_major, int minor_dir, Color c
+) {
+    // Steps whose major coordinate is inside the clip...
+    long long k0 = Max(0LL, (long long)major_lo);
+    long long k1 = Min(n, (long long)major_hi);
+    // ...and whose minor coordinate is too.
+    long long m_lo = (minor_dir > 0 ? minor_lo : -minor_hi);
+    long long m_hi = (minor_dir > 0 ? minor_hi : -minor_lo);
+    k0 = Max(k0, Line_FirstStepReaching(m_lo, n, dm));
+    k1 = Min(k1, Line_FirstStepReaching(m_hi + 1, n, dm) - 1);
+    if (k0 > k1)
+        return;
+
+    long long m = (2 * k0 * dm + n) / (2 * n);
+    long long error = 2 * k0 * dm + n - 2 * n * m;    // in [0, 2n)
+    ptrdiff_t const x_step = sizeof(Color);
+    ptrdiff_t const y_step = canvas->pitch_bytes;
+    ptrdiff_t const major_step = (x_major ? x_step : y_step);
+    ptrdiff_t const minor_step = minor_dir * (x_major ? y_step : x_step);
+    byte * p = (byte *)(x_major
+        ? canvas->pixel(x0 + int(k0), y0 + minor_dir * int(m))
+        : canvas->pixel(x0 + minor_dir * int(m), y0 + int(k0)));
 
-    float const step = float(Abs(y1 - y0)) / Abs(x1 - x0);
-    int const dir = (y1 >= y0 ? 1 : -1);
-    float error = 0.5f;
-    for (int x = x0, y = y0; x < x1; ++x) {
-        Render_Pixel(canvas, x, y, c);
-        error += step;
-        if (error >= 1.0f) {
-            error -= 1.0f;
-            y += dir;
+    for (long long count = k1 - k0 + 1; ; ) {
+        *(Color *)p = c;
+        if (--count == 0)
+            break;
+        p += major_step;
+        error += 2 * dm;
+        if (error >= 2 * n) {
+            error -= 2 * n;
+            p += minor_step;
         }
     }
-    Render_Pixel(canvas, x1, y1, c);
 }
 
 static inline void
-Render_Line_YMajor_Unchecked (Canvas * canvas, int x0, int y0, int x1, int y1, Color c) {
-    ASSERT(y0 <= y1);
+Render_Line_XMajor (Canvas * canvas, int x0, int y0, int x1, int y1, Color c) {
+    ASSERT(x0 < x1);
+    ASSERT(Abs(x1 - x0) >= Abs(y1 - y0));
+    Rect const & clip = canvas->clip;
+    Render_Line_Walk(
+        canvas, x0, y0, x1 - x0, Abs(y1 - y0),
+        clip.x0 - x0, clip.x1 - 1 - x0, clip.y0 - y0, clip.y1 - 1 - y0,
+        true, (y1 >= y0 ? 1 : -1), c
+    );
+}
+
+static inline void
+Render_Line_YMajor (Canvas * canvas, int x0, int y0, int x1, int y1, Color c) {
+    ASSERT(y0 < y1);
     ASSERT(Abs(y1 - y0) >= Abs(x1 - x0));
+    Rect const & clip = canvas->clip;
+    Render_Line_Walk(
+        canvas, x0, y0, y1 - y0, Abs(x1 - x0),
+        clip.y0 - y0, clip.y1 - 1 - y0, clip.x0 - x0, clip.x1 - 1 - x0,
+        false, (x1 >= x0 ? 1 : -1), c
+    );
+}
 
-    float const step = float(Abs(x1 - x0)) / Abs(y1 - y0);
-    int const dir = (x1 >= x0 ? 1 : -1);
-    float error = 0.5f;
-    for (int y = y0, x = x0; y < y1; ++y) {
-        Render_Pixel(canvas, x, y, c);
-        error += step;
-        if (error >= 1.0f) {
-            error -= 1.0f;
-            x += dir;
-        }
+// Cohen-Sutherland region code of a point against the clip rect.
+constexpr unsigned OutCode_Left = 1, OutCode_Right = 2, OutCode_Top = 4, OutCode_Bottom = 8;
+
+inline unsigned Render_OutCode (Canvas const * canvas, int x, int y) {
+    return (x < canvas->clip.x0 ? OutCode_Left : 0) | (x >= canvas->clip.x1 ? OutCode_Right : 0)
+         | (y < canvas->clip.y0 ? OutCode_Top : 0) | (y >= canvas->clip.y1 ? OutCode_Bottom : 0);
+}
+
+// The outcodes are only used to throw away lines that are entirely on
+// one side of the clip rect; everything else gets clipped exactly.
+static inline void
+Render_Line_Coded (Canvas * canvas, int x0, int y0, unsigned code0, int x1, int y1, unsigned code1, Color c) {
+    if (code0 & code1)
+        return;
+    int dx = Abs(x1 - x0);
+    int dy = Abs(y1 - y0);
+    if (dx >= dy) {
+        if (x0 < x1)
+            Render_Line_XMajor(canvas, x0, y0, x1, y1, c);
+        else if (x1 < x0)
+            Render_Line_XMajor(canvas, x1, y1, x0, y0, c);
+        else
+            Render_LineVert(canvas, x0, y0, y1, c);
+    } else {    // (dx < dy)
+        if (y0 < y1)
+            Render_Line_YMajor(canvas, x0, y0, x1, y1, c);
+        else
+            Render_Line_YMajor(canvas, x1, y1, x0, y0, c);
     }
-    Render_Pixel(canvas, x1, y1, c);
 }
 
 static inline void
 Render_Line (Canvas * canvas, int x0, int y0, int x1, int y1, Color c) {
-    if (canvas) {
-        int dx = Abs(x1 - x0);
-        int dy = Abs(y1 - y0);
-        if (dx >= dy) {
-            if (x0 < x1)
-                Render_Line_XMajor_Unchecked(canvas, x0, y0, x1, y1, c);
-            else if (x1 < x0)
-                Render_Line_XMajor_Unchecked(canvas, x1, y1, x0, y0, c);
-            else
-                Render_LineVert(canvas, x0, y0, y1, c);
-        } else {    // (dx < dy)
-            if (y0 < y1)
-                Render_Line_YMajor_Unchecked(canvas, x0, y0, x1, y1, c);
-            else if (y1 < y0)
-                Render_Line_YMajor_Unchecked(canvas, x1, y1, x0, y0, c);
-            else
-                Render_LineHoriz(canvas, x0, x1, y0, c);
+    PROFILE_SCOPE_HOT("Render_Line");
+    if (canvas)
+        Render_Line_Coded(canvas, x0, y0, Render_OutCode(canvas, x0, y0), x1, y1, Render_OutCode(canvas, x1, y1), c);
+}
+
+// Same pixels as calling Render_Line() on each consecutive pair of points,
+// but each point's outcode is worked out once and shared by the two
+// segments that meet there.
+static inline void
+Render_Polyline (Canvas * canvas, Vec2i const * points, int count, Color c) {
+    if (canvas && count > 1) {
+        unsigned prev_code = Render_OutCode(canvas, points[0].x, points[0].y);
+        for (int i = 1; i < count; ++i) {
+            unsigned code = Render_OutCode(canvas, points[i].x, points[i].y);
+            Render_Line_Coded(canvas, points[i - 1].x, points[i - 1].y, prev_code, points[i].x, points[i].y, code, c);
+            prev_code = code;
         }
     }
 }
 
-static void
-Render_AAB (Canvas * canvas, int x0, int y0, int w, int h, Color c) {
-    if (canvas && w > 0 && h > 0 && x0 < canvas->width && y0 < canvas->height && x0 + w >= 0 && y0 + h >= 0) {
-        if (x0 < 0) {w += x0; x0 = 0;}
-        if (y0 < 0) {h += y0; y0 = 0;}
-        if (x0 + w >= canvas->width) {w -= x0 + w - canvas->width;}
-        if (y0 + h >= canvas->height) {h -= y0 + h - canvas->height;}
+template <typename SpanOp>
+static inline void
+Render_AAB_With (Canvas * canvas, int x0, int y0, int w, int h, SpanOp const & span) {
+    PROFILE_SCOPE_HOT("Render_AAB");
+    if (canvas && w > 0 && h > 0) {
+        Rect const r = Rect_Intersect(Rect_OfAAB(x0, y0, w, h), canvas->clip);
+        if (Rect_IsEmpty(r))
+            return;
+        x0 = r.x0; w = r.x1 - r.x0;
+        y0 = r.y0; h = r.y1 - r.y0;
 
         Color * p = canvas->pixel(x0, y0);
-        for (int i = 0; i < h; ++i, p = (Color *)((byte *)p + canvas->pitch_bytes)) {
-            Color * q = p;
-            for (int j = 0; j < w; ++q, ++j) {
-                *q = c;
-            }
+        if (w == canvas->width && canvas->pitch_bytes == w * int(sizeof(Color))) {
+            // Whole rows of a tightly packed canvas; one long span it is.
+            span(p, w * h);
+        } else {
+            for (int i = 0; i < h; ++i, p = (Color *)((byte *)p + canvas->pitch_bytes))
+                span(p, w);
         }
     }
 }
 
 static inline void
-Render_Clear (Canvas * canvas, Color c) {
-    Render_AAB(canvas, 0, 0, canvas->width, canvas->height, c);
+Render_AAB (Canvas * canvas, int x0, int y0, int w, int h, Color c) {
+    Render_AAB_With(canvas, x0, y0, w, h, SpanFill{c});
+}
+
+static inline void
+Render_AAB (Canvas * canvas, int x0, int y0, int w, int h, Color c, BlendMode mode) {
+    Render_WithSpanOp(c, mode, [&](auto const & span){Render_AAB_With(canvas, x0, y0, w, h, span);});
 }
 
-static void
-Render_Circle (Canvas * canvas, int x, int y, int r, Color c) {
-    if (canvas && r >= 0) {
+static inline void
+Render_AAB (Canvas * canvas, Rect const & r, Color c, BlendMode mode = BlendMode::Opaque) {
+    Render_AAB(canvas, r.x0, r.y0, r.x1 - r.x0, r.y1 - r.y0, c, mode);
+}
+
+static inline void
+Render_Clear (Canvas * canvas, Color c, BlendMode mode = BlendMode::Opaque) {
+    PROFILE_SCOPE("Render_Clear");
+    Render_AAB(canvas, 0, 0, canvas->width, canvas->height, c, mode);
+}
+
+// Copies the pixels of "src" inside "r" to the same place in "canvas".
+// Whole rows of two canvases with the same pitch go in one memcpy.
+static inline void
+Render_Blit (Canvas * canvas, Canvas const * src, Rect const & r) {
+    PROFILE_SCOPE("Render_Blit");
+    Rect const cr = Rect_Intersect(Rect_Intersect(r, canvas->clip), Canvas_Bounds(src));
+    if (Rect_IsEmpty(cr))
+        return;
+    size_t const row_bytes = size_t(cr.x1 - cr.x0) * sizeof(Color);
+    if (canvas->pitch_bytes == src->pitch_bytes && row_bytes == size_t(canvas->pitch_bytes)) {
+        ::memcpy(canvas->pixel(0, cr.y0), src->pixel(0, cr.y0), row_bytes * (cr.y1 - cr.y0));
+    } else {
+        for (int y = cr.y0; y < cr.y1; ++y)
+            ::memcpy(canvas->pixel(cr.x0, y), src->pixel(cr.x0, y), row_bytes);
+    }
+}
+
+//----------------------------------------------------------------------
+// A circle of radius r is the row y (x +/- r), the single pixels at
+// y +/- r, and for every 0 < ey < r the rows y +/- ey spanning
+// x +/- hw[ey], with hw[ey] = sqrt(r*r - ey*ey) rounded half-up.
+// The half-widths come from an integer midpoint walk, and for the radii
+// balls and particles actually use they're computed once and cached.
+
+// hw[ey] is the largest ex with ex * (ex - 1) < r*r - ey*ey; "d" is the
+// slack in that inequality, kept up to date as ey grows and ex shrinks.
+static inline void
+Circle_HalfWidths (int r, int * out) {
+    long long ex = r;
+    long long d = (long long)r * r - ex * (ex - 1);
+    for (int ey = 0; ey < r; ++ey) {
+        while (d <= 0) {
+            d += 2 * (ex - 1);
+            ex -= 1;
+        }
+        out[ey] = int(ex);
+        d -= 2 * ey + 1;
+    }
+}
+
+struct CircleSpanCache {
+    static constexpr int MaxRadius = 256;           // radii below this are cached
+    int half_widths [MaxRadius * (MaxRadius - 1) / 2];  // radius r starts at r * (r - 1) / 2
+
+    CircleSpanCache () {
+        for (int r = 1; r < MaxRadius; ++r)
+            Circle_HalfWidths(r, half_widths + r * (r - 1) / 2);
+    }
+};
+
+// Built on first use; read-only afterwards, so any thread can draw circles.
+static inline CircleSpanCache const *
+Render_CircleSpanCache () {
+    static CircleSpanCache const cache;
+    return &cache;
+}
+
+template <typename SpanOp>
+static inline void
+Render_Circle_With (Canvas * canvas, int x, int y, int r, SpanOp const & span) {
+    PROFILE_SCOPE_HOT("Render_Circle");
+    Rect const bounds = Rect_OfCircle(x, y, r);
+    if (!canvas || r < 0 || !Rect_Overlaps(bounds, canvas->clip))
+        return;
+    if (0 == r) {
+        span(canvas->pixel(x, y), 1);
+        return;
+    }
+
+    int const * hw = nullptr;
+    if (r < CircleSpanCache::MaxRadius) {
+        hw = Render_CircleSpanCache()->half_widths + r * (r - 1) / 2;
+    } else {
+        thread_local std::vector<int> scratch;
+        scratch.resize(r);
+        Circle_HalfWidths(r, scratch.data());
+        hw = scratch.data();
+    }
+
+    if (Rect_Contains(canvas->clip, bounds)) {
+        // Entirely inside the clip; just walk down the rows.
+        int const pitch = canvas->pitch_bytes;
+        Color * center = canvas->pixel(x, y - r);
+        span(center, 1);
         for (int ey = r - 1; ey > 0; --ey) {
-            int ex = int(0.5f + sqrtf(float(r * r - ey * ey)));
-            Render_LineHoriz(canvas, x - ex, x + ex, y + ey, c);
-            Render_LineHoriz(canvas, x - ex, x + ex, y - ey, c);
+            center = (Color *)((byte *)center + pitch);
+            span(center - hw[ey], 2 * hw[ey] + 1);
+        }
+        center = (Color *)((byte *)center + pitch);
+        span(center - r, 2 * r + 1);
+        for (int ey = 1; ey < r; ++ey) {
+            center = (Color *)((byte *)center + pitch);
+            span(center - hw[ey], 2 * hw[ey] + 1);
+        }
+        center = (Color *)((byte *)center + pitch);
+        span(center, 1);
+        return;
+    }
+
+    Render_LineHoriz_With(canvas, x, x, y - r, span);
+    int const ey_top = Min(r - 1, y - canvas->clip.y0);     // rows above the center that are inside the clip
+    for (int ey = ey_top; ey > 0; --ey)
+        Render_LineHoriz_With(canvas, x - hw[ey], x + hw[ey], y - ey, span);
+    Render_LineHoriz_With(canvas, x - r, x + r, y, span);
+    int const ey_bottom = Min(r - 1, canvas->clip.y1 - 1 - y);
+    for (int ey = 1; ey <= ey_bottom; ++ey)
+        Render_LineHoriz_With(canvas, x - hw[ey], x + hw[ey], y + ey, span);
+    Render_LineHoriz_With(canvas, x, x, y + r, span);
+}
+
+static inline void
+Render_Circle (Canvas * canvas, int x, int y, int r, Color c) {
+    Render_Circle_With(canvas, x, y, r, SpanFill{c});
+}
+
+static inline void
+Render_Circle (Canvas * canvas, int x, int y, int r, Color c, BlendMode mode) {
+    Render_WithSpanOp(c, mode, [&](auto const & span){Render_Circle_With(canvas, x, y, r, span);});
+}
+
+//----------------------------------------------------------------------
+// The set of canvas regions that need to be redrawn (and re-uploaded)
+// this frame. Overlapping rects are merged as they come in; if there are
+// too many, the pair that grows the least gets merged instead, so the
+// region is always a handful of disjoint-ish rects.
+
+struct DirtyRegion {
+    static constexpr int MaxRects = 16;
+
+    Rect bounds;            // of the canvas; everything gets clipped to this
+    Rect rects [MaxRects];
+    int count;
+};
+
+inline void DirtyRegion_Reset (DirtyRegion * region, Rect const & bounds) {
+    region->bounds = bounds;
+    region->count = 0;
+}
+
+inline void DirtyRegion_AddAll (DirtyRegion * region) {
+    region->rects[0] = region->bounds;
+    region->count = 1;
+}
+
+inline long long DirtyRegion_Area (DirtyRegion const * region) {
+    long long ret = 0;
+    for (int i = 0; i < region->count; ++i)
+        ret += Rect_Area(region->rects[i]);
+    return ret;
+}
+
+static inline void
+DirtyRegion_Add (DirtyRegion * region, Rect r) {
+    r = Rect_Intersect(r, region->bounds);
+    if (Rect_IsEmpty(r))
+        return;
+
+    // Swallow everything that overlaps the new rect; the union may now
+    // overlap some rect it didn't before, so go around until it doesn't.
+    for (bool merged = true; merged; ) {
+        merged = false;
+        for (int i = 0; i < region->count; ++i) {
+            if (Rect_Overlaps(r, region->rects[i])) {
+                r = Rect_Union(r, region->rects[i]);
+                region->rects[i] = region->rects[--region->count];
+                merged = true;
+                break;
+            }
         }
-        Render_LineHoriz(canvas, x - r, x + r, y, c);
-        Render_Pixel(canvas, x, y + r, c);
-        Render_Pixel(canvas, x, y - r, c);
     }
+
+    if (region->count >= DirtyRegion::MaxRects) {
+        int best = 0;
+        long long best_growth = -1;
+        for (int i = 0; i < region->count; ++i) {
+            auto growth = Rect_Area(Rect_Union(r, region->rects[i])) - Rect_Area(region->rects[i]) - Rect_Area(r);
+            if (best_growth < 0 || growth < best_growth) {
+                best = i;
+                best_growth = growth;
+            }
+        }
+        r = Rect_Union(r, region->rects[best]);
+        region->rects[best] = region->rects[--region->count];
+        // The bigger rect can't overlap more than "count" rects, and
+        // the region is now below capacity; this recursion is shallow.
+        DirtyRegion_Add(region, r);
+        return;
+    }
+
+    region->rects[region->count++] = r;
 }
@@ -0,0 +1,144 @@
+#include <chrono>
+#include <cstdio>
+
+#include "bo_common.hpp"
+#include "bo_sim.hpp"
+#include "bo_record.hpp"
+
+// Runs the game with no window and no clock, as fast as it'll go, with
+// either the autopilot or a script at the controls; for play-testing in
+// bulk. Reports ticks per second and the state hash, which is the same on
+// every run with the same arguments. It also records input logs, and
+// plays them back (from here or from the game) as fast as it can.
+
+struct RunConfig {
+    uint64_t ticks = 1000000;
+    uint64_t report_every = 0;      // 0 means only at the end
+    char const * script_path = nullptr;
+    char const * record_path = nullptr;
+    char const * replay_path = nullptr;
+    int threads = 1;                // 0 means one per CPU core
+    SimConfig sim;
+};
+
+static bool
+ParseArgs (RunConfig * config, int argc, char * argv []) {
+    for (int i = 1; i < argc; ++i) {
+        bool const has_value = i + 1 < argc;
+        if (0 == ::strcmp(argv[i], "--ticks") && has_value) {
+            config->ticks = ::strtoull(argv[++i], nullptr, 10);
+        } else if (0 == ::strcmp(argv[i], "--report") && has_value) {
+            config->report_every = ::strtoull(argv[++i], nullptr, 10);
+        } else if (0 == ::strcmp(argv[i], "--script") && has_value) {
+            config->script_path = argv[++i];
+        } else if (0 == ::strcmp(argv[i], "--record") && has_value) {
+            config->record_path = argv[++i];
+        } else if (0 == ::strcmp(argv[i], "--replay") && has_value) {
+            config->replay_path = argv[++i];
+        } else if (0 == ::strcmp(argv[i], "--threads") && has_value) {
+            config->threads = atoi(argv[++i]);
+        } else if (0 == ::strcmp(argv[i], "--tick-hz") && has_value) {
+            config->sim.tick_hz = Max(1, atoi(argv[++i]));
+        } else if (0 == ::strcmp(argv[i], "--balls") && has_value) {
+            config->sim.serve_balls = Max(1, atoi(argv[++i]));
+        } else {
+            ::fprintf(stderr,
+                "usage: %s [--ticks n] [--report every_n_ticks] [--script file] [--record file] [--threads n] [--tick-hz n] [--balls n]\n"
+                "       %s --replay file [--threads n]\n"
+                "  --ticks     how many ticks to run (default: 1000000)\n"
+                "  --report    print the tick rate and state hash every n ticks\n"
+                "  --script    take the input from a script instead of the autopilot;\n"
+                "              lines of \"<tick> move <-1..1>\", \"<tick> serve\" or \"<tick> split\"\n"
+                "  --record    write the input of every tick into \"file\"\n"
+                "  --replay    play an input log back, and check that it ends up the same\n"
+                "  --threads   how many threads update the balls (default: 1; 0 is one per core)\n"
+                "  --tick-hz   simulation ticks per simulated second (default: 1000)\n"
+                "  --balls     put n balls into play with every serve\n",
+                argv[0], argv[0]);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main (int argc, char * argv []) {
+    RunConfig config;
+    if (!ParseArgs(&config, argc, argv))
+        return 1;
+
+    SimScript script = {};
+    if (config.script_path && !SimScript_Load(&script, config.script_path)) {
+        ::fprintf(stderr, "couldn't read script \"%s\"\n", config.script_path);
+        return 1;
+    }
+
+    InputReplay replay = {};
+    if (config.replay_path && !InputReplay_Open(&replay, config.replay_path)) {
+        ::fprintf(stderr, "can't read the input log \"%s\"\n", config.replay_path);
+        return 1;
+    }
+
+    Collide_Init();
+    JobPool pool;
+    JobPool_Start(&pool, config.threads > 0 ? config.threads : Platform_CPUCount());
+    Sim sim;
+
+    using Clock = std::chrono::steady_clock;
+    if (config.replay_path) {
+        Sim_Init(&sim, replay.config, &pool);
+        auto const start = Clock::now();
+        InputReplay_Advance(&replay, &sim, UINT64_MAX);
+        double const run_s = std::chrono::duration<double>(Clock::now() - start).count();
+        ::printf("%llu ticks replayed in %.3f s  (%.0f ticks/s, %.0fx real time)\n",
+            (unsigned long long)sim.ticks, run_s, sim.ticks / run_s, sim.ticks / double(replay.config.tick_hz) / run_s);
+        bool const ok = InputReplay_Check(&replay, &sim);
+        JobPool_Stop(&pool);
+        return ok ? 0 : 1;
+    }
+
+    Sim_Init(&sim, config.sim, &pool);
+    InputRecorder recorder = {};
+    if (config.record_path && !InputRecorder_Open(&recorder, config.record_path, config.sim)) {
+        ::fprintf(stderr, "can't write the input log \"%s\"\n", config.record_path);
+        JobPool_Stop(&pool);
+        return 1;
+    }
+
+    auto const start = Clock::now();
+    auto last_report = start;
+    uint64_t last_report_tick = 0;
+    for (uint64_t tick = 0; tick < config.ticks; ++tick) {
+        SimInput const input = (config.script_path ? SimScript_Input(&script, tick) : Sim_Autopilot(&sim));
+        Sim_Act(&sim, input);
+        Sim_Tick(&sim, input);
+        if (config.record_path) {
+            InputRecorder_Act(&recorder, input);
+            InputRecorder_Tick(&recorder, input);
+        }
+        sim.removed.clear();
+
+        if (config.report_every > 0 && (tick + 1) % config.report_every == 0) {
+            auto const now = Clock::now();
+            double const s = std::chrono::duration<double>(now - last_report).count();
+            ::printf("tick %10llu  %12.0f ticks/s  balls %5d  bricks %3d  hash %016llx\n",
+                (unsigned long long)(tick + 1), double(tick + 1 - last_report_tick) / s,
+                sim.state.balls.count, sim.bricks.count, (unsigned long long)Sim_Hash(&sim));
+            last_report = now;
+            last_report_tick = tick + 1;
+        }
+    }
+    double const run_s = std::chrono::duration<double>(Clock::now() - start).count();
+
+    ::printf("%llu ticks (%.1f s simulated) in %.3f s  (%.0f ticks/s, %.1f ns/tick, collide: %s)  final hash %016llx\n",
+        (unsigned long long)config.ticks, double(config.ticks) / config.sim.tick_hz, run_s,
+        config.ticks / run_s, run_s / config.ticks * 1e9, g_collide_kernel.name,
+        (unsigned long long)Sim_Hash(&sim));
+    if (sim.ball_steps > 0)
+        ::printf("%.0f ball ticks, %.1f%% of them with nothing to hit, %.2f brick queries each; %d bricks left\n",
+            sim.ball_steps, sim.quiet_ball_steps / sim.ball_steps * 100, sim.queries / sim.ball_steps, sim.bricks.count);
+
+    if (config.record_path && !InputRecorder_Close(&recorder, &sim))
+        ::fprintf(stderr, "couldn't write all of the input log \"%s\"\n", config.record_path);
+    JobPool_Stop(&pool);
+    return 0;
+}
@@ -0,0 +1,555 @@
+#pragma once
+
+#include "bo_common.hpp"
+#include "bo_math.hpp"
+#include "bo_render.hpp"
+#include "bo_grid.hpp"
+#include "bo_bricks.hpp"
+#include "bo_balls.hpp"
+#include "bo_collide.hpp"
+#include "bo_jobs.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+// The game itself: input in, paddle, balls and bricks out, one fixed tick
+// at a time. There are no windows, events, clocks or pixels in here, so
+// the SDL front end (bo_main.cpp) and the bulk runner (bo_run.cpp) step
+// the very same thing; the runner just does it as fast as it can.
+
+struct SimConfig {
+    int tick_hz = 1000;
+    int serve_balls = 1;            // how many balls a serve puts into play
+    int balls_per_job = 256;        // the ball update is split into jobs of this many
+    int max_impacts_per_tick = 16;
+    int width = 600, height = 800;  // of the field, which has walls all around
+
+    float paddle_speed = 1000.0f;
+    float paddle_vert_pos = 0.90f;
+    Vec2f paddle_half_dims = {80, 10};
+    float ball_radius = 10.0f;
+    float ball_speed = 700.0f;
+
+    Vec2f brick_half_dims = {40, 20};
+    Color brick_color = {50, 50, 250};
+};
+
+// The wall of bricks a game starts with: rows * cols of them, row by row
+// from the top; their slots (in a fresh game) go in that order too.
+constexpr int SimBrickRows = 8;
+constexpr int SimBrickCols = 6;
+
+inline Point2f Sim_BrickCenter (SimConfig const & config, int row, int col) {
+    return {config.brick_half_dims.x + 48.0f + 84.0f * col, config.brick_half_dims.y + 40.0f + 44.0f * row};
+}
+
+struct SimInput {
+    float movement = 0.0f;  // in [-1..1]; held for as long as it's passed in
+    bool serve = false;
+    bool split_balls = false;
+};
+
+struct SimState {
+    Point2f paddle_pos = {300, 300};
+    Point2f paddle_prev_pos = {300, 300};   // at the start of the last tick
+    BallStore balls = {};           // just the one, sitting on the paddle, until it's served
+    bool ball_in_movement = false;
+};
+
+// Bricks are in the grid under their slot, which doesn't change while
+// they're alive.
+static inline void
+Sim_AddBrick (BrickStore * bricks, SpatialGrid * grid, Point2f const & center, Vec2f const & half_dims, Color c) {
+    int const slot = BrickStore_Add(bricks, center, half_dims, c);
+    SpatialGrid_Insert(grid, slot, center - half_dims, center + half_dims);
+}
+
+static inline void
+Sim_RemoveBrick (BrickStore * bricks, SpatialGrid * grid, int slot) {
+    SpatialGrid_Remove(grid, slot);
+    BrickStore_Remove(bricks, slot);
+}
+
+// What one job of the ball update found out. Bricks are only recorded
+// here, in the order they were hit, and taken out once every ball has
+// moved; so all the balls see the same field, and it doesn't matter how
+// the jobs were spread over threads.
+struct BallJob {
+    std::vector<int> hit_balls, hit_slots;  // parallel
+    std::vector<int> lost_balls;
+    int quiet_steps;                        // balls that only had to be moved along
+    int queries;                            // trips to the grid for nearby bricks
+    std::vector<int> candidate_slots;       // scratch from here on
+    std::vector<float> x, y, half_w, half_h;
+};
+
+// Puts the bricks near [lo, hi] into the job's scratch arrays, in slot
+// order, leaving out the ones hit since "first_hit".
+static inline BrickBatch
+Sim_GatherBricks (BrickStore const & bricks, SpatialGrid const * grid, Point2f const & lo, Point2f const & hi, BallJob * job, size_t first_hit) {
+    job->queries += 1;
+    SpatialGrid_Collect(grid, lo, hi, &job->candidate_slots);
+    job->x.clear();
+    job->y.clear();
+    job->half_w.clear();
+    job->half_h.clear();
+    int n = 0;
+    for (int slot : job->candidate_slots) {
+        if (std::find(job->hit_slots.begin() + first_hit, job->hit_slots.end(), slot) != job->hit_slots.end())
+            continue;
+        int const i = bricks.index_of[slot];
+        job->candidate_slots[n++] = slot;
+        job->x.push_back(bricks.x[i]);
+        job->y.push_back(bricks.y[i]);
+        job->half_w.push_back(bricks.half_w[i]);
+        job->half_h.push_back(bricks.half_h[i]);
+    }
+    return {job->x.data(), job->y.data(), job->half_w.data(), job->half_h.data(), n};
+}
+
+// How long, in seconds, a ball at "pos" going along "dir" can go without
+// possibly hitting anything: the nearest wall, the first brick on the way
+// there, and the top of the paddle's band (wherever the paddle is in it,
+// so the paddle moving doesn't change this.) The result is a little short
+// of the real thing, so that rounding never lets a ball skip an impact.
+// "gather(lo, hi)" gives the bricks that might be in [lo, hi], as for
+// Sim_MoveBall().
+template <typename Gather>
+static inline float
+Sim_QuietTime (SimConfig const & config, Point2f const & paddle_pos, Point2f const & pos, Vec2f const & dir, Gather && gather) {
+    Real const R = config.ball_radius;
+    Vec2f const v = dir * config.ball_speed;
+    Real const pc [2] = {pos.x, pos.y}, vc [2] = {v.x, v.y};
+    Real const wall_lo [2] = {0 + R, 0 + R};
+    Real const wall_hi [2] = {config.width - R, config.height - R};
+    Real t = std::numeric_limits<Real>::infinity();
+    for (int a = 0; a < 2; ++a) {
+        if (vc[a] < 0)
+            t = Min(t, (wall_lo[a] - pc[a]) / vc[a]);
+        else if (vc[a] > 0)
+            t = Min(t, (wall_hi[a] - pc[a]) / vc[a]);
+    }
+    Real const paddle_top = paddle_pos.y - config.paddle_half_dims.y - R;
+    if (pos.y >= paddle_top)
+        return 0.0f;
+    if (v.y > 0)
+        t = Min(t, (paddle_top - pos.y) / v.y);
+    if (!(t > 0))
+        return 0.0f;
+
+    Vec2f const m = v * t;
+    Point2f const lo = {Min(pos.x, pos.x + m.x) - R, Min(pos.y, pos.y + m.y) - R};
+    Point2f const hi = {Max(pos.x, pos.x + m.x) + R, Max(pos.y, pos.y + m.y) + R};
+    BrickHit const brick_hit = Collide_CircleBricks(pos, R, m, gather(lo, hi));
+    if (brick_hit.index >= 0)
+        t *= brick_hit.collision.param;
+    return Max(0.0f, t * 0.99f - 0.0001f);
+}
+
+enum class SimMove {Done, Capped, Lost};
+
+// Moves a ball at "pos" going along "dir" through one tick. Each step
+// finds the earliest impact among the paddle, the walls and the bricks
+// near what's left of the path, moves the ball up to it and bounces it,
+// until the tick is used up or the ball has bounced "max_impacts_per_tick"
+// times (then it just stops there for the rest of the tick.)
+//
+// The bricks come from "gather(lo, hi)", which returns the ones that might
+// be in [lo, hi] as a BrickBatch, in a fixed order, leaving out any that
+// have been hit in this tick; "hit(i)" is called when the brick at index i
+// of the last batch is hit. That's all it knows about how bricks are kept,
+// so the game and the batched environments (bo_env.hpp) move balls alike.
+template <typename Gather, typename OnHit>
+static inline SimMove
+Sim_MoveBall (
+    SimConfig const & config, float dt, Point2f const & paddle_pos, Vec2f const & paddle_movement,
+    Point2f * pos, Vec2f * dir, Gather && gather, OnHit && hit, std::vector<Point2f> * trail
+) {
+    enum class Hit {None, Paddle, Wall, Brick};
+    Real const R = config.ball_radius;
+    // The walls, as the lines the ball's center can't cross.
+    Real const wall_lo [2] = {0 + R, 0 + R};
+    Real const wall_hi [2] = {config.width - R, config.height - R};
+
+    Real rem = 1.0f;
+    Point2f bp = *pos;
+    Vec2f bd = *dir;
+    SimMove ret = SimMove::Done;
+    for (int impact = 0; rem > 0.001f; ++impact) {
+        if (impact >= config.max_impacts_per_tick) {
+            ret = SimMove::Capped;
+            break;
+        }
+        auto const bm = bd * (config.ball_speed * dt * rem);
+        Hit kind = Hit::None;
+        Real hit_t = 2.0f;
+        Point2f hit_point = {};
+        Vec2f hit_normal = {};
+        int hit_index = -1;
+
+        // The paddle, from wherever it has got to by now in the tick.
+        auto const paddle_collision = Collide_CircleAAB(
+            bp, R, bm,
+            paddle_pos + paddle_movement * (1.0f - rem), config.paddle_half_dims, paddle_movement * rem
+        );
+        if (paddle_collision.exists) {
+            kind = Hit::Paddle;
+            hit_t = paddle_collision.param;
+            hit_point = paddle_collision.point;
+            hit_normal = paddle_collision.normal;
+        }
+
+        // The walls; a ball that's already past one and still going out
+        // gets turned around right away.
+        Real const pc [2] = {bp.x, bp.y}, mc [2] = {bm.x, bm.y};
+        for (int a = 0; a < 2; ++a) {
+            Real t = 2.0f, n = 0.0f;
+            if (mc[a] < 0) {
+                t = (wall_lo[a] - pc[a]) / mc[a];
+                n = +1.0f;
+            } else if (mc[a] > 0) {
+                t = (wall_hi[a] - pc[a]) / mc[a];
+                n = -1.0f;
+            }
+            t = Max(t, 0.0f);
+            if (t <= 1.0f && t < hit_t) {
+                kind = Hit::Wall;
+                hit_t = t;
+                hit_point = bp + bm * t;
+                hit_normal = (0 == a ? Vec2f{n, 0.0f} : Vec2f{0.0f, n});
+            }
+        }
+
+        // The bricks; only the ones near the path are tested, and the
+        // earliest hit wins (the first one gathered on ties.)
+        Point2f const sweep_lo = {Min(bp.x, bp.x + bm.x) - R, Min(bp.y, bp.y + bm.y) - R};
+        Point2f const sweep_hi = {Max(bp.x, bp.x + bm.x) + R, Max(bp.y, bp.y + bm.y) + R};
+        BrickHit const brick_hit = Collide_CircleBricks(bp, R, bm, gather(sweep_lo, sweep_hi));
+        if (brick_hit.index >= 0 && brick_hit.collision.param < hit_t) {
+            kind = Hit::Brick;
+            hit_t = brick_hit.collision.param;
+            hit_point = brick_hit.collision.point;
+            hit_normal = brick_hit.collision.normal;
+            hit_index = brick_hit.index;
+        }
+
+        if (Hit::None == kind) {
+            bp = bp + bm;
+            break;
+        }
+        bp = hit_point;
+        bd = Normalize(Reflect(bd, hit_normal));
+        rem -= hit_t * rem;
+        if (trail)
+            trail->push_back(hit_point);
+        if (Hit::Brick == kind)
+            hit(hit_index);
+        if (Hit::Wall == kind && hit_normal.y < 0) {
+            // Lost the ball!
+            ret = SimMove::Lost;
+            break;
+        }
+    }
+    *pos = bp;
+    *dir = bd;
+    return ret;
+}
+
+// Moves ball "b" through one tick (see Sim_MoveBall()); a brick it has
+// already hit in this tick is treated as gone. A ball that can't hit
+// anything in this tick (see Sim_QuietTime()) is just moved along. Returns
+// whether the ball went out through the bottom.
+static inline bool
+Sim_StepBall (
+    SimConfig const & config, float dt, Point2f const & paddle_pos, Vec2f const & paddle_movement,
+    BrickStore const & bricks, SpatialGrid const * grid, BallStore * balls, int b, BallJob * job,
+    std::vector<Point2f> * trail
+) {
+    if (balls->quiet_s[b] >= dt) {
+        balls->x[b] += balls->dir_x[b] * (config.ball_speed * dt);
+        balls->y[b] += balls->dir_y[b] * (config.ball_speed * dt);
+        balls->quiet_s[b] -= dt;
+        job->quiet_steps += 1;
+        if (trail)
+            trail->push_back(BallStore_Pos(balls, b));
+        return false;
+    }
+
+    size_t const first_hit = job->hit_slots.size();
+    auto gather = [&](Point2f const & lo, Point2f const & hi){
+        return Sim_GatherBricks(bricks, grid, lo, hi, job, first_hit);
+    };
+    auto hit = [&](int i){
+        job->hit_balls.push_back(b);
+        job->hit_slots.push_back(job->candidate_slots[i]);
+    };
+    Point2f bp = BallStore_Pos(balls, b);
+    Vec2f bd = BallStore_Dir(balls, b);
+    SimMove const move = Sim_MoveBall(config, dt, paddle_pos, paddle_movement, &bp, &bd, gather, hit, trail);
+    BallStore_Set(balls, b, bp, bd);
+    if (SimMove::Lost == move)
+        return true;
+    if (SimMove::Done == move)
+        balls->quiet_s[b] = Sim_QuietTime(config, paddle_pos + paddle_movement, bp, bd, gather);
+    if (trail)
+        trail->push_back(bp);
+    return false;
+}
+
+struct Sim {
+    SimConfig config;
+    SimState state;
+    BrickStore bricks;
+    SpatialGrid grid;
+    JobPool * pool;                 // may be null; then it's all on the caller's thread
+    std::vector<BallJob> jobs;
+    std::vector<unsigned char> lost_balls;
+
+    std::vector<Rect> removed;      // bricks taken out; for whoever draws them to clear
+    std::vector<Point2f> * trail;   // if set, ball 0's path goes here
+
+    uint64_t ticks;
+    double ball_steps, quiet_ball_steps;
+    double queries;                 // see BallJob
+};
+
+// A fresh game: the wall of bricks, and the ball on the paddle.
+static inline void
+Sim_Init (Sim * sim, SimConfig const & config, JobPool * pool) {
+    SimConfig const & c = config;
+    sim->config = config;
+    sim->state = {};
+    sim->state.paddle_pos = sim->state.paddle_prev_pos = {0.5f * c.width, c.paddle_vert_pos * c.height};
+    BallStore_Add(&sim->state.balls, {}, {});
+    BrickStore_Clear(&sim->bricks);
+    SpatialGrid_Init(&sim->grid, {0.0f, 0.0f}, {float(c.width), float(c.height)}, 2.0f * c.brick_half_dims);
+    for (int i = 0; i < SimBrickRows; ++i)
+        for (int j = 0; j < SimBrickCols; ++j)
+            Sim_AddBrick(&sim->bricks, &sim->grid, Sim_BrickCenter(c, i, j), c.brick_half_dims, c.brick_color);
+    sim->pool = pool;
+    sim->jobs.clear();
+    sim->removed.clear();
+    sim->trail = nullptr;
+    sim->ticks = 0;
+    sim->ball_steps = sim->quiet_ball_steps = 0;
+    sim->queries = 0;
+}
+
+// The one-off parts of the input: serving and splitting.
+static inline void
+Sim_Act (Sim * sim, SimInput const & input) {
+    SimConfig const & config = sim->config;
+    SimState & state = sim->state;
+    if (input.serve && !state.ball_in_movement) {
+        // The first ball goes off at 45 degrees; any others fan out
+        // from there towards the other side.
+        float const side = (input.movement >= 0 ? 1.0f : -1.0f);
+        Point2f const serve_pos = BallStore_Pos(&state.balls, 0);
+        state.ball_in_movement = true;
+        BallStore_Set(&state.balls, 0, serve_pos, Normalize({side, -1.0f}));
+        for (int k = 1; k < config.serve_balls; ++k)
+            BallStore_Add(&state.balls, serve_pos, Normalize({side * (1.0f - 2.0f * k / config.serve_balls), -1.0f}));
+    }
+    if (input.split_balls && state.ball_in_movement) {
+        // Multi-ball: every ball gets a twin, going off mirrored.
+        for (int b = 0, n = state.balls.count; b < n; ++b)
+            BallStore_Add(&state.balls, BallStore_Pos(&state.balls, b), {-state.balls.dir_x[b], state.balls.dir_y[b]});
+    }
+}
+
+static inline void
+Sim_Tick (Sim * sim, SimInput const & input) {
+    PROFILE_SCOPE("Sim_Tick");
+    SimConfig const & config = sim->config;
+    SimState & state = sim->state;
+    float const dt = 1.0f / config.tick_hz;
+    state.paddle_prev_pos = state.paddle_pos;
+    BallStore_KeepPrevious(&state.balls);
+    state.paddle_pos.x += input.movement * config.paddle_speed * dt;
+    if (state.paddle_pos.x < config.paddle_half_dims.x)
+        state.paddle_pos.x = config.paddle_half_dims.x;
+    if (state.paddle_pos.x > config.width - config.paddle_half_dims.x)
+        state.paddle_pos.x = config.width - config.paddle_half_dims.x;
+    sim->ticks += 1;
+
+    if (!state.ball_in_movement) {
+        BallStore_Set(&state.balls, 0, {
+            state.paddle_pos.x,
+            state.paddle_pos.y - config.paddle_half_dims.y - config.ball_radius
+        }, {});
+        return;
+    }
+
+    // Every job moves its own run of balls against the field as it was at
+    // the start of the tick; then, in ball order, the bricks they hit go
+    // away and the lost balls leave.
+    int const job_count = (state.balls.count + config.balls_per_job - 1) / config.balls_per_job;
+    if (int(sim->jobs.size()) < job_count)
+        sim->jobs.resize(job_count);
+    auto move_balls = [&](int j){
+        PROFILE_SCOPE("move balls");
+        BallJob & job = sim->jobs[j];
+        job.hit_balls.clear();
+        job.hit_slots.clear();
+        job.lost_balls.clear();
+        job.quiet_steps = 0;
+        job.queries = 0;
+        int const end = Min(state.balls.count, (j + 1) * config.balls_per_job);
+        for (int b = j * config.balls_per_job; b < end; ++b) {
+            std::vector<Point2f> * trail = (0 == b ? sim->trail : nullptr);
+            if (Sim_StepBall(config, dt, state.paddle_prev_pos, state.paddle_pos - state.paddle_prev_pos, sim->bricks, &sim->grid, &state.balls, b, &job, trail))
+                job.lost_balls.push_back(b);
+        }
+    };
+    if (sim->pool)
+        JobPool_ForEach(sim->pool, job_count, move_balls);
+    else
+        for (int j = 0; j < job_count; ++j)
+            move_balls(j);
+
+    sim->lost_balls.assign(state.balls.count, 0);
+    int lost_count = 0;
+    int queries = 0;
+    sim->ball_steps += state.balls.count;
+    for (int j = 0; j < job_count; ++j) {
+        BallJob const & job = sim->jobs[j];
+        sim->quiet_ball_steps += job.quiet_steps;
+        queries += job.queries;
+        for (int slot : job.hit_slots) {
+            if (sim->bricks.index_of[slot] < 0)
+                continue;   // an earlier ball got there first
+            sim->removed.push_back(BrickStore_Rect(&sim->bricks, sim->bricks.index_of[slot]));
+            Sim_RemoveBrick(&sim->bricks, &sim->grid, slot);
+        }
+        for (int b : job.lost_balls) {
+            sim->lost_balls[b] = 1;
+            lost_count += 1;
+        }
+    }
+    sim->queries += queries;
+    TRACE_COUNTER("collision queries", queries);
+    if (lost_count == state.balls.count) {
+        // That was the last one; it goes back on the paddle.
+        for (int b = 0; b < state.balls.count; ++b)
+            if (sim->lost_balls[b]) {
+                BallStore_Set(&state.balls, 0, BallStore_Pos(&state.balls, b), BallStore_Dir(&state.balls, b));
+                break;
+            }
+        sim->lost_balls.assign(state.balls.count, 1);
+        sim->lost_balls[0] = 0;
+        state.ball_in_movement = false;
+    }
+    if (lost_count > 0)
+        BallStore_RemoveIf(&state.balls, sim->lost_balls);
+}
+
+// Somebody to play when nobody's at the keyboard: serves (once the ball
+// has been on the paddle for a tick), then keeps the paddle under the
+// lowest ball.
+static inline SimInput
+Sim_Autopilot (Sim const * sim) {
+    SimState const & state = sim->state;
+    int lowest = 0;
+    for (int b = 1; b < state.balls.count; ++b)
+        if (state.balls.y[b] > state.balls.y[lowest])
+            lowest = b;
+    float const slack = 0.25f * sim->config.paddle_half_dims.x;
+    SimInput ret;
+    ret.serve = !state.ball_in_movement && sim->ticks > 0;
+    if (state.balls.x[lowest] < state.paddle_pos.x - slack)
+        ret.movement = -1.0f;
+    else if (state.balls.x[lowest] > state.paddle_pos.x + slack)
+        ret.movement = 1.0f;
+    return ret;
+}
+
+// FNV-1a over everything that decides what happens next; two runs that
+// agree on this are in the same state, to the bit.
+static inline uint64_t
+Sim_Hash (Sim const * sim) {
+    uint64_t h = 0xCBF29CE484222325ULL;
+    auto mix = [&](void const * data, size_t size){
+        for (size_t i = 0; i < size; ++i)
+            h = (h ^ ((byte const *)data)[i]) * 0x100000001B3ULL;
+    };
+    SimState const & state = sim->state;
+    mix(&state.paddle_pos, sizeof(state.paddle_pos));
+    mix(&state.ball_in_movement, sizeof(state.ball_in_movement));
+    mix(&state.balls.count, sizeof(state.balls.count));
+    mix(state.balls.x.data(), state.balls.count * sizeof(float));
+    mix(state.balls.y.data(), state.balls.count * sizeof(float));
+    mix(state.balls.dir_x.data(), state.balls.count * sizeof(float));
+    mix(state.balls.dir_y.data(), state.balls.count * sizeof(float));
+    mix(&sim->bricks.count, sizeof(sim->bricks.count));
+    mix(sim->bricks.slot_of.data(), sim->bricks.count * sizeof(int));
+    return h;
+}
+
+//----------------------------------------------------------------------
+
+// Scripted input, for play-tests that have to go the same way every time.
+// A script is lines of "<tick> <command>", in tick order, where command is
+// one of "move <-1..1>", "serve" or "split"; '#' starts a comment. A move
+// holds until the next one.
+struct SimScript {
+    struct Event {
+        uint64_t tick;
+        char command;               // 'm', 's' or 'x'
+        float value;
+    };
+    std::vector<Event> events;
+    size_t next;
+    float movement;
+};
+
+static inline bool
+SimScript_Load (SimScript * script, char const * path) {
+    *script = {};
+    FILE * file = ::fopen(path, "r");
+    if (!file)
+        return false;
+    char line [256];
+    int line_number = 0;
+    bool ok = true;
+    while (ok && ::fgets(line, sizeof(line), file)) {
+        line_number += 1;
+        if (char * comment = ::strchr(line, '#'))
+            *comment = '\0';
+        unsigned long long tick = 0;
+        char command [16] = {};
+        float value = 0.0f;
+        int const fields = ::sscanf(line, "%llu %15s %f", &tick, command, &value);
+        if (fields <= 0)
+            continue;   // blank
+        SimScript::Event e = {tick, 0, value};
+        if (0 == ::strcmp(command, "move") && 3 == fields)
+            e.command = 'm';
+        else if (0 == ::strcmp(command, "serve"))
+            e.command = 's';
+        else if (0 == ::strcmp(command, "split"))
+            e.command = 'x';
+        if (0 == e.command || (!script->events.empty() && tick < script->events.back().tick)) {
+            ::fprintf(stderr, "%s:%d: bad line\n", path, line_number);
+            ok = false;
+        }
+        script->events.push_back(e);
+    }
+    ::fclose(file);
+    return ok;
+}
+
+// The input for tick "tick"; call it for every tick, in order.
+static inline SimInput
+SimScript_Input (SimScript * script, uint64_t tick) {
+    SimInput ret;
+    for (; script->next < script->events.size() && script->events[script->next].tick <= tick; ++script->next) {
+        SimScript::Event const & e = script->events[script->next];
+        switch (e.command) {
+        case 'm': script->movement = Min(Max(e.value, -1.0f), 1.0f); break;
+        case 's': ret.serve = true; break;
+        case 'x': ret.split_balls = true; break;
+        }
+    }
+    ret.movement = script->movement;
+    return ret;
+}
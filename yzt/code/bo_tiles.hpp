@@ -0,0 +1,124 @@
+#pragma once
+
+#include "bo_common.hpp"
+#include "bo_render.hpp"
+#include "bo_drawlist.hpp"
+#include "bo_jobs.hpp"
+#include <vector>
+
+// Executes a DrawList by binning its commands into screen tiles and then
+// rasterizing the tiles in parallel. A tile is small enough to stay in
+// L1/L2 while every command touching it is drawn. Each tile draws its
+// commands in list order, clipped to the tile, and none of the Render_*
+// primitives produce different pixels depending on the clip, so the
+// result is exactly what DrawList_Execute() would have produced.
+
+struct TiledRenderer {
+    static constexpr int TileSize = 64;
+    static constexpr int MinParallelTiles = 8;  // below this, waking the workers costs more than it saves
+
+    JobPool * pool;
+    int tiles_x, tiles_y;
+    std::vector<std::vector<int>> bins;     // command indices, per tile
+    std::vector<int> active_tiles;          // the ones with something to do
+    std::vector<byte> tile_wanted;
+
+    // Inputs for the current execution; only valid inside Execute().
+    Canvas const * canvas;
+    DrawList const * list;
+    Rect const * rects;
+    int rect_count;
+};
+
+inline void TiledRenderer_Init (TiledRenderer * tr, JobPool * pool) {
+    tr->pool = pool;
+    tr->tiles_x = tr->tiles_y = 0;
+}
+
+static inline void
+TiledRenderer_DrawTile (TiledRenderer * tr, int tile) {
+    PROFILE_SCOPE("tile");
+    int const tx = tile % tr->tiles_x, ty = tile / tr->tiles_x;
+    int const ts = TiledRenderer::TileSize;
+    Rect const tile_rect = Rect_Intersect({tx * ts, ty * ts, tx * ts + ts, ty * ts + ts}, tr->canvas->clip);
+
+    Canvas tc = *tr->canvas;
+    auto const & bin = tr->bins[tile];
+    for (int r = 0; r < tr->rect_count; ++r) {
+        Rect const clip = Rect_Intersect(tile_rect, tr->rects[r]);
+        if (Rect_IsEmpty(clip))
+            continue;
+        tc.clip = clip;
+        for (int i : bin)
+            if (Rect_Overlaps(DrawCmd_Bounds(tr->list->cmds[i]), clip))
+                Render_Cmd(&tc, tr->list, tr->list->cmds[i]);
+    }
+}
+
+// Draws "list" into "canvas", but only inside the given rects (and the
+// canvas clip.) The rects must not overlap: each one is drawn on its own,
+// so where two did, anything blended would be blended in twice. (A
+// DirtyRegion's rects never overlap.)
+static inline void
+TiledRenderer_Execute (TiledRenderer * tr, Canvas * canvas, DrawList const * list, Rect const * rects, int rect_count) {
+    PROFILE_SCOPE("TiledRenderer_Execute");
+#if !defined(NDEBUG)
+    for (int r = 0; r < rect_count; ++r)
+        for (int q = r + 1; q < rect_count; ++q)
+            ASSERT(!Rect_Overlaps(rects[r], rects[q]), "TiledRenderer_Execute() needs disjoint rects.");
+#endif
+    int const ts = TiledRenderer::TileSize;
+    int const tiles_x = (canvas->width + ts - 1) / ts;
+    int const tiles_y = (canvas->height + ts - 1) / ts;
+    if (tiles_x != tr->tiles_x || tiles_y != tr->tiles_y) {
+        tr->tiles_x = tiles_x;
+        tr->tiles_y = tiles_y;
+        tr->bins.resize(size_t(tiles_x) * tiles_y);
+        tr->tile_wanted.resize(size_t(tiles_x) * tiles_y);
+    }
+
+    tr->canvas = canvas;
+    tr->list = list;
+    tr->rects = rects;
+    tr->rect_count = rect_count;
+
+    // Which tiles are we going to draw at all?
+    tr->active_tiles.clear();
+    ::memset(tr->tile_wanted.data(), 0, tr->tile_wanted.size());
+    for (int r = 0; r < rect_count; ++r) {
+        Rect const rr = Rect_Intersect(rects[r], canvas->clip);
+        if (Rect_IsEmpty(rr))
+            continue;
+        for (int ty = rr.y0 / ts; ty <= (rr.y1 - 1) / ts; ++ty)
+            for (int tx = rr.x0 / ts; tx <= (rr.x1 - 1) / ts; ++tx) {
+                int t = ty * tiles_x + tx;
+                if (!tr->tile_wanted[t]) {
+                    tr->tile_wanted[t] = 1;
+                    tr->bins[t].clear();
+                    tr->active_tiles.push_back(t);
+                }
+            }
+    }
+
+    // Binning; every command goes into each wanted tile it overlaps.
+    for (int i = 0; i < list->count; ++i) {
+        Rect const b = Rect_Intersect(DrawCmd_Bounds(list->cmds[i]), canvas->clip);
+        if (Rect_IsEmpty(b))
+            continue;
+        for (int ty = b.y0 / ts; ty <= (b.y1 - 1) / ts; ++ty)
+            for (int tx = b.x0 / ts; tx <= (b.x1 - 1) / ts; ++tx) {
+                int t = ty * tiles_x + tx;
+                if (tr->tile_wanted[t])
+                    tr->bins[t].push_back(i);
+            }
+    }
+
+    int const active_count = int(tr->active_tiles.size());
+    if (!tr->pool || active_count < TiledRenderer::MinParallelTiles) {
+        for (int i = 0; i < active_count; ++i)
+            TiledRenderer_DrawTile(tr, tr->active_tiles[i]);
+    } else {
+        auto draw = [tr](int i){TiledRenderer_DrawTile(tr, tr->active_tiles[i]);};
+        JobPool_ForEach(tr->pool, active_count, draw);
+    }
+}
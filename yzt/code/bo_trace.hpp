@@ -0,0 +1,174 @@
+#pragma once
+
+// A timeline of what every thread was doing, written out as Chrome
+// trace-event JSON (open it in ui.perfetto.dev or chrome://tracing.)
+//
+//      PROFILE_SCOPE("name");          a span, from here to the end of the block
+//      PROFILE_SCOPE_HOT("name");      the same, for tiny functions that run
+//                                      thousands of times a frame
+//      TRACE_COUNTER("name", value);   a value over time
+//      TRACE_FRAME(index);             a marker across every thread
+//
+// None of it is there unless the build defines BO_TRACE: 1 for the frame,
+// the sim and the renderer, 2 to add the PROFILE_SCOPE_HOT ones too.
+// Without it, the macros are empty and their arguments aren't evaluated.
+// Compiled in, it costs a flag test until Trace_Start().
+//
+// Every thread appends to a buffer of its own, so there's no locking on
+// the way in. Trace_Write() reads all of them, so it has to be called when
+// no other thread is tracing; between frames, the job pool is idle. Names
+// have to be string literals, or at least outlive the trace, and are
+// written out as they are.
+
+#if defined(BO_TRACE) && BO_TRACE > 0
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+struct TraceEvent {
+    char const * name;
+    uint64_t ts_ns;
+    uint64_t dur_ns;    // for spans
+    double value;       // for counters; the frame number for frame markers
+    char type;          // 'X' span, 'C' counter, 'F' frame marker
+};
+
+struct TraceBuffer {
+    std::vector<TraceEvent> events;
+    int tid;
+};
+
+struct TraceState {
+    std::atomic<bool> on {false};
+    std::mutex mutex;                   // for the list of buffers
+    std::vector<TraceBuffer *> buffers; // one per thread that ever traced; never freed
+    uint64_t start_ns = 0;
+};
+
+inline TraceState g_trace;
+
+inline uint64_t Trace_Now () {
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+inline bool Trace_IsOn () {return g_trace.on.load(std::memory_order_relaxed);}
+
+static inline TraceBuffer *
+Trace_ThreadBuffer () {
+    thread_local TraceBuffer * buffer = nullptr;
+    if (!buffer) {
+        buffer = new TraceBuffer;
+        buffer->events.reserve(4096);
+        std::lock_guard<std::mutex> lock (g_trace.mutex);
+        buffer->tid = int(g_trace.buffers.size());
+        g_trace.buffers.push_back(buffer);
+    }
+    return buffer;
+}
+
+inline void Trace_Add (TraceEvent const & e) {Trace_ThreadBuffer()->events.push_back(e);}
+
+inline void Trace_Span (char const * name, uint64_t start_ns, uint64_t end_ns) {
+    if (Trace_IsOn())
+        Trace_Add({name, start_ns, end_ns - start_ns, 0.0, 'X'});
+}
+
+inline void Trace_Counter (char const * name, double value) {
+    if (Trace_IsOn())
+        Trace_Add({name, Trace_Now(), 0, value, 'C'});
+}
+
+inline void Trace_Frame (uint64_t index) {
+    if (Trace_IsOn())
+        Trace_Add({"frame", Trace_Now(), 0, double(index), 'F'});
+}
+
+struct TraceScope {
+    char const * name;  // null if tracing was off when the scope began
+    uint64_t start_ns;
+
+    explicit TraceScope (char const * name_) : name (Trace_IsOn() ? name_ : nullptr), start_ns (name ? Trace_Now() : 0) {}
+    ~TraceScope () {
+        if (name)
+            Trace_Add({name, start_ns, Trace_Now() - start_ns, 0.0, 'X'});
+    }
+    TraceScope (TraceScope const &) = delete;
+    TraceScope & operator = (TraceScope const &) = delete;
+};
+
+// The thread that starts the trace shows up first, as "main".
+inline void Trace_Start () {
+    Trace_ThreadBuffer();
+    if (0 == g_trace.start_ns)
+        g_trace.start_ns = Trace_Now();
+    g_trace.on.store(true, std::memory_order_relaxed);
+}
+
+inline void Trace_Stop () {g_trace.on.store(false, std::memory_order_relaxed);}
+
+// Writes everything recorded since the last write into "path", and starts
+// over. Only when no other thread is tracing (see above.)
+static inline bool
+Trace_Write (char const * path) {
+    FILE * f = ::fopen(path, "w");
+    if (!f)
+        return false;
+    std::lock_guard<std::mutex> lock (g_trace.mutex);
+    ::fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    auto us = [](uint64_t ns){return double(ns) * 1e-3;};
+    for (TraceBuffer * buffer : g_trace.buffers) {
+        ::fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+            first ? "" : ",\n", buffer->tid, 0 == buffer->tid ? "main" : "thread", buffer->tid);
+        first = false;
+        for (TraceEvent const & e : buffer->events) {
+            double const ts = us(e.ts_ns - g_trace.start_ns);
+            switch (e.type) {
+            case 'X':
+                ::fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+                    e.name, ts, us(e.dur_ns), buffer->tid);
+                break;
+            case 'C':
+                ::fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"value\":%g}}",
+                    e.name, ts, buffer->tid, e.value);
+                break;
+            case 'F':
+                ::fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"g\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"frame\":%.0f}}",
+                    e.name, ts, buffer->tid, e.value);
+                break;
+            }
+        }
+        buffer->events.clear();
+    }
+    ::fprintf(f, "\n]}\n");
+    return 0 == ::fclose(f);
+}
+
+#define BO_TRACE_CONCAT2(a, b)      a##b
+#define BO_TRACE_CONCAT(a, b)       BO_TRACE_CONCAT2(a, b)
+#define PROFILE_SCOPE(name)         TraceScope BO_TRACE_CONCAT(trace_scope_, __LINE__) (name)
+#if BO_TRACE >= 2
+    #define PROFILE_SCOPE_HOT(name) PROFILE_SCOPE(name)
+#else
+    #define PROFILE_SCOPE_HOT(name) ((void)0)
+#endif
+#define TRACE_COUNTER(name, value)  Trace_Counter(name, double(value))
+#define TRACE_FRAME(index)          Trace_Frame(uint64_t(index))
+
+#else
+
+inline bool Trace_IsOn () {return false;}
+inline void Trace_Start () {}
+inline void Trace_Stop () {}
+inline bool Trace_Write (char const *) {return false;}
+
+#define PROFILE_SCOPE(name)         ((void)0)
+#define PROFILE_SCOPE_HOT(name)     ((void)0)
+#define TRACE_COUNTER(name, value)  ((void)0)
+#define TRACE_FRAME(index)          ((void)0)
+
+#endif